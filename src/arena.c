@@ -0,0 +1,96 @@
+#include "arena.h"
+
+// the allocations are aligned to this many bytes
+#define ARENA_ALIGNMENT 16
+
+#define AlignSize(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+// the memory of a chunk starts after its header
+#define ChunkData(chunk) ((char*)(chunk) + AlignSize(sizeof(ArenaChunk)))
+
+static ArenaChunk* NewChunk(const size_t size) {
+    ArenaChunk* chunk = CkallocOrDie(AlignSize(sizeof(ArenaChunk)) + size);
+    chunk->next = NULL;
+    chunk->used = 0;
+    chunk->size = size;
+    return chunk;
+}
+
+void InitArena(Arena* const arena, const size_t chunk_size) {
+    ForceAssert(chunk_size > 0);
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size;
+    arena->num_bytes = 0;
+}
+
+void* ArenaAllocOrDie(Arena* const arena, const size_t size) {
+    const size_t aligned = AlignSize(size);
+    ArenaChunk* chunk = arena->chunks;
+    void* ptr;
+
+    arena->num_bytes += aligned;
+
+    // a large request gets its own chunk, which goes behind the current one so
+    // the space left in that is not lost
+    if (aligned > arena->chunk_size / 4) {
+        ArenaChunk* const large = NewChunk(aligned);
+        large->used = aligned;
+        if (chunk) {
+            large->next = chunk->next;
+            chunk->next = large;
+        } else {
+            arena->chunks = large;
+        }
+        return ChunkData(large);
+    }
+
+    if ((chunk == NULL) || (chunk->used + aligned > chunk->size)) {
+        chunk = NewChunk(arena->chunk_size);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    ptr = ChunkData(chunk) + chunk->used;
+    chunk->used += aligned;
+    return ptr;
+}
+
+void* ArenaAlloczOrDie(Arena* const arena, const size_t size) {
+    void* ptr = ArenaAllocOrDie(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void ResetArena(Arena* const arena) {
+    ArenaChunk* keep = NULL;
+    ArenaChunk* chunk = arena->chunks;
+
+    while (chunk) {
+        ArenaChunk* const next = chunk->next;
+        if ((keep == NULL) && (chunk->size == arena->chunk_size)) {
+            keep = chunk;
+        } else {
+            Ckfree(chunk);
+        }
+        chunk = next;
+    }
+
+    if (keep) {
+        keep->next = NULL;
+        keep->used = 0;
+    }
+    arena->chunks = keep;
+    arena->num_bytes = 0;
+}
+
+void FreeArena(Arena* const arena) {
+    ArenaChunk* chunk = arena->chunks;
+
+    while (chunk) {
+        ArenaChunk* const next = chunk->next;
+        Ckfree(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena->num_bytes = 0;
+}
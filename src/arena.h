@@ -0,0 +1,44 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <inttypes.h>
+
+#include "utilities.h"
+
+// a chunk of memory that is handed out from the front
+typedef struct ArenaChunk_st {
+    struct ArenaChunk_st* next;
+    size_t used;
+    size_t size;
+} ArenaChunk;
+
+// An arena hands out memory from large chunks, and all of it is released
+// together when the arena is freed. There is no way to free a single
+// allocation, so it is meant for objects that live until the end of a stage.
+typedef struct Arena_st {
+    ArenaChunk* chunks;
+    size_t chunk_size;
+    uint64_t num_bytes;     // the bytes that were handed out
+} Arena;
+
+// the default size of the chunks in an arena
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+// initialize an arena that allocates chunks of chunk_size bytes
+void InitArena(Arena* const arena, const size_t chunk_size);
+
+// Return size bytes from the arena, aligned for any of the basic types. Large
+// requests get a chunk of their own.
+void* ArenaAllocOrDie(Arena* const arena, const size_t size);
+
+// same as above, but the memory is set to zero
+void* ArenaAlloczOrDie(Arena* const arena, const size_t size);
+
+// Forget everything that was allocated from the arena. One of the chunks is
+// kept, so an arena that is reset often does not go back to the system.
+void ResetArena(Arena* const arena);
+
+// release all the memory in the arena
+void FreeArena(Arena* const arena);
+
+#endif  // ARENA_H_
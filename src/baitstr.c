@@ -0,0 +1,509 @@
+extern "C" {
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include "inttypes.h"
+#include <pthread.h>
+
+#include "utilities.h"
+#include "clparsing.h"
+#include "kmer.h"
+#include "fastq_seq.h"
+#include "bloom_filter.h"
+#include "thread_pool.h"
+#include "str_scanner.h"
+#include "merged_block.h"
+#include "trace.h"
+}
+
+#include "sparse_kmer_hash.h"
+#include "kmer_counter.h"
+#include "str_merger.h"
+#include "str_extender.h"
+
+char* program_version       = "";
+char* program_name          = "baitstr";
+char* program_description   =
+    "Select, merge and extend the reads that support an STR";
+char* program_use           =
+    "baitstr run [options] gs cov klen reads1.fq reads2.fq ...";
+
+Bool debug_flag;
+
+// the number of batches of reads that are shared by the reader and the thread
+// that counts the kmers in them
+#define NUM_KMER_BATCHES 4
+
+// the number of reads in a batch
+#define KMER_BATCH_SIZE 10000
+
+// a batch of consecutive reads, of which only the bases are kept
+typedef struct KmerBatch_st {
+    FastqSequence* reads;
+    uint num_reads;
+} KmerBatch;
+
+// The first pass of the kmer counting is done on a thread of its own, while
+// the reads are selected and merged. The reads are copied into batches that
+// are handed to that thread, so it sees them in the order of the input.
+typedef struct KmerCounter_st {
+    SparseHashMap kmers;
+    BloomFilter* singletons;
+    uint kmer_length;
+    uint64_t num_expected_kmers;
+    KmerBatch batches[NUM_KMER_BATCHES];
+    KmerBatch* filling;      // the batch the reader is filling, if any
+    BlockingQueue free;      // batches that can be filled
+    BlockingQueue filled;    // batches whose kmers have to be counted
+    pthread_t thread;
+} KmerCounter;
+
+// the merged blocks, which are kept in memory until they are extended
+typedef struct BlockList_st {
+    MergedBlock* blocks;
+    uint64_t num_blocks;
+    uint64_t allocated;
+    uint64_t next;           // the next block to be extended
+    FILE* fp;                // the blocks are also written here, if it is set
+} BlockList;
+
+// add the kmers in the batches to the candidates, till the end of the reads
+static void* CountKmersInBatches(void* arg) {
+    KmerCounter* const counter = (KmerCounter*)arg;
+    KmerBatch* batch;
+    uint indx;
+
+    SetTraceTrack(COUNTER_TRACK, "kmer counter");
+    while ((batch = (KmerBatch*)PopFromQueue(&counter->filled)) != NULL) {
+        StartThreadPhase(KMER_PASS1_PHASE);
+        for (indx = 0; indx < batch->num_reads; indx++) {
+            AddCandidateKmers(counter->kmers, counter->singletons,
+                              batch->reads + indx, counter->kmer_length,
+                              counter->num_expected_kmers);
+        }
+        EndPhase(KMER_PASS1_PHASE);
+        PushToQueue(&counter->free, batch);
+    }
+
+    return NULL;
+}
+
+// copy the bases of the read into the batch that is being filled, and hand
+// the batch over once it is full
+static void QueueReadForCounting(void* const arg,
+                                 const FastqSequence* const sequence) {
+    KmerCounter* const counter = (KmerCounter*)arg;
+
+    if (counter->filling == NULL) {
+        counter->filling = (KmerBatch*)PopFromQueue(&counter->free);
+        counter->filling->num_reads = 0;
+    }
+
+    KmerBatch* const batch = counter->filling;
+    FastqSequence* const copy = batch->reads + batch->num_reads++;
+    if (copy->bases_length < sequence->slen + 1) {
+        copy->bases_length = sequence->slen + 1;
+        copy->bases = (char*)CkreallocOrDie(copy->bases, copy->bases_length);
+    }
+    memcpy(copy->bases, sequence->bases, sequence->slen);
+    copy->bases[sequence->slen] = '\0';
+    copy->slen = sequence->slen;
+
+    if (batch->num_reads == KMER_BATCH_SIZE) {
+        PushToQueue(&counter->filled, batch);
+        counter->filling = NULL;
+    }
+}
+
+static void StartKmerCounter(KmerCounter* const counter) {
+    uint indx;
+
+    counter->filling = NULL;
+    InitBlockingQueue(&counter->free, NUM_KMER_BATCHES + 1);
+    InitBlockingQueue(&counter->filled, NUM_KMER_BATCHES + 1);
+    for (indx = 0; indx < NUM_KMER_BATCHES; indx++) {
+        KmerBatch* const batch = counter->batches + indx;
+        batch->reads = (FastqSequence*)CkalloczOrDie(KMER_BATCH_SIZE *
+                                                     sizeof(FastqSequence));
+        batch->num_reads = 0;
+        PushToQueue(&counter->free, batch);
+    }
+
+    if (pthread_create(&counter->thread, NULL, CountKmersInBatches,
+                       counter) != 0) {
+        PrintThenDie("Error in creating the thread to count the kmers");
+    }
+}
+
+// wait for the kmers in all the reads that were queued to be counted
+static void FinishKmerCounter(KmerCounter* const counter) {
+    uint indx, rindx;
+
+    if (counter->filling != NULL) {
+        PushToQueue(&counter->filled, counter->filling);
+        counter->filling = NULL;
+    }
+    PushToQueue(&counter->filled, NULL);
+    pthread_join(counter->thread, NULL);
+
+    for (indx = 0; indx < NUM_KMER_BATCHES; indx++) {
+        KmerBatch* const batch = counter->batches + indx;
+        for (rindx = 0; rindx < KMER_BATCH_SIZE; rindx++) {
+            if (batch->reads[rindx].bases) Ckfree(batch->reads[rindx].bases);
+        }
+        Ckfree(batch->reads);
+    }
+    FreeBlockingQueue(&counter->free);
+    FreeBlockingQueue(&counter->filled);
+}
+
+// keep a copy of the merged block, without its quals
+static void KeepMergedBlock(void* const arg, const MergedBlock* const block) {
+    BlockList* const list = (BlockList*)arg;
+
+    if (list->fp) WriteMergedBlock(list->fp, block);
+
+    if (list->num_blocks == list->allocated) {
+        list->allocated = list->allocated ? 2 * list->allocated : 1024;
+        list->blocks = (MergedBlock*)CkreallocOrDie(list->blocks,
+                       list->allocated * sizeof(MergedBlock));
+    }
+
+    MergedBlock* const copy = list->blocks + list->num_blocks++;
+    memset(copy, 0, sizeof(MergedBlock));
+    copy->name = CopyString(block->name);
+    copy->name_allocated = strlen(block->name) + 1;
+    memcpy(copy->motif, block->motif, sizeof(copy->motif));
+    copy->copies = CopyString(block->copies);
+    copy->copies_allocated = strlen(block->copies) + 1;
+    copy->zstart = block->zstart;
+    copy->end = block->end;
+    copy->bases = (char*)CkallocOrDie(block->slen + 1);
+    memcpy(copy->bases, block->bases, block->slen + 1);
+    copy->slen = block->slen;
+}
+
+static const MergedBlock* NextMergedBlock(void* const arg) {
+    BlockList* const list = (BlockList*)arg;
+    if (list->next == list->num_blocks) return NULL;
+    return list->blocks + list->next++;
+}
+
+// the bases of the block, the way a read with them is seen by the counting
+static void GetBlockSequence(const MergedBlock* const block,
+                             FastqSequence* const sequence) {
+    memset(sequence, 0, sizeof(FastqSequence));
+    sequence->bases = block->bases;
+    sequence->slen = block->slen;
+}
+
+// The second pass of the kmer counting, over the reads and then over the
+// blocks. The candidates that are seen less than min_threshold or more than
+// max_threshold times are removed.
+static void CountNonSingletonKmers(SparseHashMap& kmers,
+                                   const uint kmer_length,
+                                   char** const fqnames,
+                                   const uint num_files,
+                                   const BlockList* const list,
+                                   const uint min_threshold,
+                                   const uint max_threshold) {
+    FastqSequence block_sequence;
+    uint64_t bindx;
+    uint findx;
+
+    StartPhase(KMER_PASS2_PHASE);
+    for (findx = 0; findx < num_files; findx++) {
+        const uint64_t start = GetTraceTime();
+        uint64_t num_reads = 0;
+        FastqSequence* sequence = ReadFastqSequence(fqnames[findx], FALSE,
+                                                    FALSE);
+        while (sequence) {
+            CountCandidateKmers(kmers, sequence, kmer_length);
+            num_reads++;
+            sequence = GetNextSequence(sequence);
+        }
+        CloseFastqSequence(sequence);
+        TraceSpan("read_file", start, fqnames[findx], num_reads);
+        PrintDebugMessage("2. Done with all the sequences in %s",
+                          fqnames[findx]);
+    }
+    for (bindx = 0; bindx < list->num_blocks; bindx++) {
+        GetBlockSequence(list->blocks + bindx, &block_sequence);
+        CountCandidateKmers(kmers, &block_sequence, kmer_length);
+    }
+    EndPhase(KMER_PASS2_PHASE);
+
+    RemoveRareKmers(kmers, min_threshold, max_threshold);
+}
+
+static FILE* OpenStageOutput(CommandLineArguments* const cl_options,
+                             const char* const option) {
+    char* fname = GetOptionStringValue(cl_options, option);
+    if (fname == NULL) return NULL;
+    return CkopenOrDie(fname, "w");
+}
+
+/*
+ * The reads are selected, merged and extended in a single process, which
+ * gives the same contigs as running scan_STR_reads, merge_STR_reads and
+ * extend_STR_reads one after the other with the same options.
+ *  a) The reads are read and scanned once, and the STR reads are merged as
+ *     they are selected. Every read is also queued for the first pass of the
+ *     kmer counting, which runs on a thread of its own at the same time.
+ *  b) The merged blocks are kept in memory. Their kmers are added to the
+ *     candidates once all the reads have been seen.
+ *  c) The second pass of the kmer counting needs all the candidates, so it
+ *     reads the fastq files once more after the merging is done.
+ *  d) The blocks are then extended from memory, and the contigs are printed.
+ * The selected reads, the merged blocks and the candidate kmers are only
+ * written out if they are asked for.
+ */
+int main(int argc, char** argv) {
+    // start time management
+    t0 = time(0);
+    InitMetrics();
+
+    // set the version number
+    program_version = VERSION;
+
+    // parse the command line
+    CommandLineArguments* cl_options = NewCommandLineArguments();
+
+    // these are the valid options for the various commands
+    AddOption(&cl_options, "numcopies", "2", TRUE, TRUE,
+    "require at least this number of copies", NULL);
+    AddOption(&cl_options, "flanks", "31", TRUE, TRUE,
+    "require >= these many bps around the STR on each side", NULL);
+    AddOption(&cl_options, "illumina", "FALSE", FALSE, TRUE,
+    "the quality values are encoded as q + 64", NULL);
+    AddOption(&cl_options, "periods", "23456", TRUE, TRUE,
+    "the lengths of the motifs to look for", NULL);
+    AddOption(&cl_options, "removehm", "FALSE", FALSE, TRUE,
+    "ignore STR that harbor homopolymer runs", NULL);
+    AddOption(&cl_options, "altalgo", "TRUE", FALSE, TRUE,
+    "check the flanks before picking the best STR", NULL);
+    AddOption(&cl_options, "min_reads", "4", TRUE, TRUE,
+    "Discard blocks that include < min_reads reads", NULL);
+    AddOption(&cl_options, "max_reads", "10000", TRUE, TRUE,
+    "Discard blocks that include > max_reads reads", NULL);
+    AddOption(&cl_options, "all", "FALSE", FALSE, TRUE,
+    "include non-polymorphic blocks", NULL);
+    AddOption(&cl_options, "filter", "FALSE", FALSE, TRUE,
+    "skip aligning to blocks whose flanks differ a lot from the read", NULL);
+    AddOption(&cl_options, "tmpdir", NULL, TRUE, TRUE,
+    "merge the reads in sorted runs written to this directory", NULL);
+    AddOption(&cl_options, "run_size", RUN_SIZE, TRUE, TRUE,
+    "the number of reads in a sorted run", NULL);
+    AddOption(&cl_options, "min_threshold", "2", TRUE, TRUE,
+    "Discard kmers that are observed < min_threshold", NULL);
+    AddOption(&cl_options, "max_threshold", "255", TRUE, TRUE,
+    "Discard kmers that are observed > max_threshold", NULL);
+    AddOption(&cl_options, "extension", "1024", TRUE, TRUE,
+    "the maximum size of flanks extension", NULL);
+    AddOption(&cl_options, "ploidy", "2", TRUE, TRUE,
+    "the ploidy of the genome", NULL);
+    AddOption(&cl_options, "heterozygosity", "0.001", TRUE, TRUE,
+    "fraction of nucleotides that differ between inherited chromosomes", NULL);
+    AddOption(&cl_options, "errorrate", "0.01", TRUE, TRUE,
+    "expected error rate in sequencing", NULL);
+    AddOption(&cl_options, "indels", "0", TRUE, TRUE,
+    "extend through bubbles from indels of up to these many bases", NULL);
+    AddOption(&cl_options, "threads", "1", TRUE, TRUE,
+    "use these many threads to merge and extend the reads", NULL);
+    AddOption(&cl_options, "progress", "1000000", TRUE, TRUE,
+    "print progress every so many sequences", NULL);
+    AddOption(&cl_options, "selected", NULL, TRUE, TRUE,
+    "write the selected reads to this file", NULL);
+    AddOption(&cl_options, "merged", NULL, TRUE, TRUE,
+    "write the merged blocks to this file", NULL);
+    AddOption(&cl_options, "kmers", NULL, TRUE, TRUE,
+    "write the first pass of the kmer counting to this file", NULL);
+    AddOption(&cl_options, "metrics", NULL, TRUE, TRUE,
+    "write the time spent in every phase and the counters to this file as JSON",
+    NULL);
+    AddOption(&cl_options, "trace", NULL, TRUE, TRUE,
+    "write a timeline of the phases, the batches and the threads to this file",
+    NULL);
+
+    ParseOptions(&cl_options, &argc, &argv);
+
+    // does the user just want some help
+    Bool print_help = GetOptionBoolValueOrDie(cl_options, "help");
+    if (print_help == TRUE) {
+        PrintSimpleUsageString(cl_options);
+        return EXIT_SUCCESS;
+    }
+
+    // does the user know what he/she is doing?
+    if ((argc < 6) || (strcmp(argv[1], "run") != 0)) {
+        PrintSimpleUsageString(cl_options);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t haploid_genome_size;
+    if (sscanf(argv[2], "%"PRIu64, &haploid_genome_size) != 1) {
+        PrintMessageThenDie("Expected genome size should be an integer: %s",
+        argv[2]);
+    }
+
+    uint expected_coverage;
+    if (sscanf(argv[3], "%u", &expected_coverage) != 1) {
+        PrintMessageThenDie("Expected coverage should be an integer: %s",
+        argv[3]);
+    }
+
+    uint kmer_length;
+    if (sscanf(argv[4], "%u", &kmer_length) != 1) {
+        #ifdef Large
+        PrintMessageThenDie("Kmer length should be an odd integer < 64: %s",
+        argv[4]);
+        #else
+        PrintMessageThenDie("Kmer length should be an odd integer < 32: %s",
+        argv[4]);
+        #endif
+    }
+    if (kmer_length % 2 == 0) {
+        PrintWarning("Kmer length should be an odd integer, using %u",
+        --kmer_length);
+    }
+
+    char** fqnames = argv + 5;
+    uint num_files = argc - 5;
+
+    // do I need additional debug info
+    debug_flag = GetOptionBoolValueOrDie(cl_options, "debug");
+
+    // how often should I print progress?
+    uint progress_chunk = GetOptionUintValueOrDie(cl_options, "progress");
+
+    // number of threads
+    uint num_threads = GetOptionUintValueOrDie(cl_options, "threads");
+    if (num_threads == 0) {
+        PrintThenDie("The number of threads should be at least 1");
+    }
+
+    char* trace_name = GetOptionStringValue(cl_options, "trace");
+    if (trace_name != NULL) OpenTrace(trace_name, "baitstr");
+
+    // the reads are scanned for STRs as they are read
+    uint flanks = GetOptionUintValueOrDie(cl_options, "flanks");
+    if (flanks < kmer_length) {
+        PrintWarning("The flanks should be at least %u bps long", kmer_length);
+    }
+    STRScanner* scanner =
+        NewSTRScanner(MAX(GetOptionUintValueOrDie(cl_options, "numcopies"), 1),
+                      flanks,
+                      GetOptionStringValue(cl_options, "periods"),
+                      GetOptionBoolValueOrDie(cl_options, "removehm"),
+                      GetOptionBoolValueOrDie(cl_options, "altalgo"));
+
+    // should the reads be merged on disk?
+    char* tmpdir = GetOptionStringValue(cl_options, "tmpdir");
+    uint run_size = GetOptionUintValueOrDie(cl_options, "run_size");
+    if (run_size == 0) {
+        PrintThenDie("The number of reads in a sorted run should be > 0");
+    }
+
+    // the kmers are counted while the reads are selected and merged
+    uint64_t genome_size = ExpectedGenomeSize(haploid_genome_size,
+                           kmer_length,
+                           GetOptionUintValueOrDie(cl_options, "ploidy"),
+                           GetOptionDoubleValueOrDie(cl_options,
+                                                     "heterozygosity"));
+    KmerCounter* counter = new KmerCounter;
+    counter->kmer_length = kmer_length;
+    counter->num_expected_kmers = ExpectedNumberOfKmers(genome_size,
+                                  kmer_length, expected_coverage,
+                                  GetOptionDoubleValueOrDie(cl_options,
+                                                            "errorrate"));
+    PrintDebugMessage("Expecting %"PRIu64" kmers in this dataset with haploid "
+                      "genome size %"PRIu64" bps.",
+                      counter->num_expected_kmers, haploid_genome_size);
+    counter->singletons = NewBloomFilter(0.1, counter->num_expected_kmers, 0);
+    InitKmerTable(counter->kmers, genome_size);
+    StartKmerCounter(counter);
+
+    // select and merge the reads
+    FILE* selected_fp = OpenStageOutput(cl_options, "selected");
+    BlockList list;
+    memset(&list, 0, sizeof(BlockList));
+    list.fp = OpenStageOutput(cl_options, "merged");
+
+    STRReadSource source;
+    OpenSTRReadSource(&source, fqnames, num_files,
+                      GetOptionBoolValueOrDie(cl_options, "illumina"),
+                      scanner, selected_fp, QueueReadForCounting, counter);
+    if (tmpdir != NULL) {
+        if (num_threads > 1) {
+            PrintWarning("The reads are merged with one thread with %s",
+                         "--tmpdir");
+        }
+        MergeShortTandemRepeatReadsOnDisk(kmer_length, &source, progress_chunk,
+            GetOptionUintValueOrDie(cl_options, "min_reads"),
+            GetOptionUintValueOrDie(cl_options, "max_reads"),
+            GetOptionBoolValueOrDie(cl_options, "all"),
+            GetOptionBoolValueOrDie(cl_options, "filter"),
+            tmpdir, run_size, KeepMergedBlock, &list);
+    } else {
+        MergeShortTandemRepeatReads(kmer_length, &source, progress_chunk,
+            GetOptionUintValueOrDie(cl_options, "min_reads"),
+            GetOptionUintValueOrDie(cl_options, "max_reads"),
+            GetOptionBoolValueOrDie(cl_options, "all"),
+            GetOptionBoolValueOrDie(cl_options, "filter"),
+            num_threads, KeepMergedBlock, &list);
+    }
+    if (selected_fp) fclose(selected_fp);
+    if (list.fp) fclose(list.fp);
+    list.fp = NULL;
+    PrintDebugMessage("Merged the STR reads into %"PRIu64" blocks.",
+                      list.num_blocks);
+    FreeSTRScanner(&scanner);
+
+    // the first pass is done once the blocks are added to the candidates
+    FinishKmerCounter(counter);
+    char* kmers_name = GetOptionStringValue(cl_options, "kmers");
+    if (kmers_name != NULL) {
+        WriteCandidateKmers(counter->kmers, counter->singletons, kmer_length,
+                            kmers_name);
+    }
+
+    FastqSequence block_sequence;
+    uint64_t bindx;
+    StartPhase(KMER_PASS1_PHASE);
+    for (bindx = 0; bindx < list.num_blocks; bindx++) {
+        GetBlockSequence(list.blocks + bindx, &block_sequence);
+        AddCandidateKmers(counter->kmers, counter->singletons, &block_sequence,
+                          kmer_length, counter->num_expected_kmers);
+    }
+    EndPhase(KMER_PASS1_PHASE);
+    PrintDebugMessage("1. Counted %zu different kmers", counter->kmers.size());
+    PrintStatsForBloomFilter(counter->singletons);
+    FreeBloomFilter(&counter->singletons);
+
+    CountNonSingletonKmers(counter->kmers, kmer_length, fqnames, num_files,
+        &list,
+        GetOptionUintValueOrDie(cl_options, "min_threshold"),
+        GetOptionUintValueOrDie(cl_options, "max_threshold"));
+    PrintDebugMessage("Read %zu kmers that are observed at least 2 times.",
+                      counter->kmers.size());
+
+    // extend the blocks
+    ExtendMergedBlocks(counter->kmers, kmer_length,
+                       GetOptionUintValueOrDie(cl_options, "extension"),
+                       GetOptionUintValueOrDie(cl_options, "indels"),
+                       num_threads, NextMergedBlock, &list);
+    PrintDebugMessage("Done with the extensions of %"PRIu64" blocks",
+                      list.num_blocks);
+
+    char* metrics_name = GetOptionStringValue(cl_options, "metrics");
+    if (metrics_name != NULL) WriteMetrics(metrics_name, "baitstr");
+    CloseTrace();
+
+    for (bindx = 0; bindx < list.num_blocks; bindx++) {
+        FreeMergedBlock(list.blocks + bindx);
+    }
+    if (list.blocks) Ckfree(list.blocks);
+    delete counter;
+    FreeParseOptions(&cl_options, &argv);
+    return EXIT_SUCCESS;
+}
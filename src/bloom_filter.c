@@ -183,6 +183,38 @@ void PrintStatsForBloomFilter(const BloomFilter* const bf) {
     fprintf(stderr, "\n");
 }
 
+Bool WriteBloomFilter(const BloomFilter* const bf, FILE* const fp) {
+    if ((fwrite(&bf->seed, sizeof(bf->seed), 1, fp) != 1) ||
+        (fwrite(&bf->false_positive_rate, sizeof(float), 1, fp) != 1) ||
+        (fwrite(&bf->num_hash_functions, sizeof(uint), 1, fp) != 1) ||
+        (fwrite(&bf->num_bits, sizeof(uint64_t), 1, fp) != 1) ||
+        (fwrite(&bf->num_set_bits, sizeof(uint64_t), 1, fp) != 1) ||
+        (fwrite(&bf->num_entries_added, sizeof(uint64_t), 1, fp) != 1) ||
+        (fwrite(bf->bs->bits, 1, bf->bs->byte_size, fp) != bf->bs->byte_size)){
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BloomFilter* ReadBloomFilter(FILE* const fp) {
+    BloomFilter* bf = CkalloczOrDie(sizeof(BloomFilter));
+
+    if ((fread(&bf->seed, sizeof(bf->seed), 1, fp) != 1) ||
+        (fread(&bf->false_positive_rate, sizeof(float), 1, fp) != 1) ||
+        (fread(&bf->num_hash_functions, sizeof(uint), 1, fp) != 1) ||
+        (fread(&bf->num_bits, sizeof(uint64_t), 1, fp) != 1) ||
+        (fread(&bf->num_set_bits, sizeof(uint64_t), 1, fp) != 1) ||
+        (fread(&bf->num_entries_added, sizeof(uint64_t), 1, fp) != 1)) {
+        PrintThenDie("Error in reading the bloom filter");
+    }
+    bf->bs = NewBitset(bf->num_bits);
+    if (fread(bf->bs->bits, 1, bf->bs->byte_size, fp) != bf->bs->byte_size) {
+        PrintThenDie("Error in reading the bloom filter");
+    }
+
+    return bf;
+}
+
 void FreeBloomFilter(BloomFilter** pbf) {
     BloomFilter* bf = *pbf;
     Ckfree(bf->bs->bits);
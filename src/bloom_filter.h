@@ -40,6 +40,12 @@ Bool CheckKmerInBloomFilter(BloomFilter* const bf, const Kmer word);
 
 void PrintStatsForBloomFilter(const BloomFilter* const bf);
 
+// write the bloom filter to the file, so it can be read by another tool
+Bool WriteBloomFilter(const BloomFilter* const bf, FILE* const fp);
+
+// read a bloom filter that was written with WriteBloomFilter
+BloomFilter* ReadBloomFilter(FILE* const fp);
+
 void FreeBloomFilter(BloomFilter** pbf);
 
 #endif
@@ -17,11 +17,17 @@
     typedef uint64_t Kmer;
 #endif
 
-// datatype to store the count of the Kmer as well as the information whether
-// the Kmer has been seen before or not
+// datatype to store the count of the Kmer. The edges of the Kmer in the de Bruijn
+// graph of the solid Kmers are stored as a mask, where bit b (b + 4) is set if
+// the Kmer in its canonical orientation can be extended to the left (right)
+// with the base b. Every solid Kmer is also part of exactly one unitig, and we
+// store its position among the Kmers of all the unitigs in 48 bits, split in
+// two so that Kcount takes 8 bytes, the same as a Kmer.
 typedef struct Kcount_st {
     uint8_t count;
-    uint8_t flag;
+    uint8_t edges;
+    uint16_t position_high;
+    uint32_t position_low;
 } Kcount;
 
 // return the first Kmer from this sequence
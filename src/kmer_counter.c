@@ -0,0 +1,195 @@
+#include <math.h>
+
+#include "kmer_counter.h"
+
+extern Bool debug_flag;
+
+// the start of a file of candidate kmers
+#define CANDIDATES_MAGIC 0x4B434E44
+
+uint64_t ExpectedGenomeSize(const uint64_t haploid_genome_size,
+                            const uint kmer_length,
+                            const uint ploidy,
+                            const double heterozygosity) {
+    return haploid_genome_size *
+           (1 + heterozygosity * (ploidy - 1) * kmer_length);
+}
+
+uint64_t ExpectedNumberOfKmers(const uint64_t genome_size,
+                               const uint kmer_length,
+                               const uint expected_coverage,
+                               const double error_rate) {
+    return genome_size *
+           (1 + (expected_coverage * (1 - pow((1-error_rate),kmer_length))));
+}
+
+void InitKmerTable(SparseHashMap& kmers, const uint64_t genome_size) {
+    kmers.rehash(genome_size);
+    #ifdef Large
+    kmers.set_deleted_key(0xFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF);
+    #else
+    kmers.set_deleted_key(0xFFFFFFFFFFFFFFFF);
+    #endif
+}
+
+void AddCandidateKmers(SparseHashMap& kmers,
+                       BloomFilter* const singletons,
+                       const FastqSequence* const sequence,
+                       const uint kmer_length,
+                       const uint64_t num_expected_kmers) {
+    Kmer word, antiword, stored;
+    char buffer[65];
+    char* pbuffer = buffer;
+
+    if (sequence->slen < kmer_length) return;
+
+    // a load factor greater than 0.7-0.8 is a sign that the user did
+    // not select the expected number of kmers judiciously. Lets warn
+    // the user, as increasing the size of the hashtable can be very
+    // slow.
+    if (kmers.load_factor() > 0.8) {
+        PrintWarning("Current load factor: %2.6f",
+        kmers.load_factor());
+        PrintWarning(
+        "Try increasing expected number of kmers from %"PRIu64,
+        num_expected_kmers);
+    }
+
+    // let account for all the kmers in this sequence
+    word = BuildIndex(sequence->bases, kmer_length);
+    uint num_kmers = strlen(sequence->bases) - kmer_length + 1;
+    uint num_bloom_probes = 0, num_bloom_hits = 0;
+
+    for (uint i = 0; i < num_kmers; i++) {
+        word = GetNextKmer(word, sequence->bases, kmer_length, i);
+
+        antiword = ReverseComplementKmer(word, kmer_length);
+        stored = word < antiword ? word : antiword;
+
+        if (CheckKmerInSparseHashMap(kmers, stored) == FALSE) {
+            num_bloom_probes++;
+            if (CheckKmerInBloomFilter(singletons, stored) == TRUE) {
+                num_bloom_hits++;
+                // this kmer has already been seen once, so add K
+                // to the hashtable
+                kmers[stored].count = 0;
+                kmers[stored].edges = 0;
+                if (debug_flag == TRUE) {
+                    ConvertKmerToString(word, kmer_length, &pbuffer);
+                    buffer[kmer_length] = '\0';
+                    PrintDebugMessage("1. Adding kmer %s", buffer);
+                }
+            } else {
+                // add it only to the bloom filter
+                AddKmerToBloomFilter(singletons, stored);
+            }
+        }
+    }
+
+    AddToCounter(PASS1_READS, 1);
+    AddToCounter(PASS1_KMERS, num_kmers);
+    AddToCounter(HASH_PROBES, num_kmers);
+    AddToCounter(BLOOM_PROBES, num_bloom_probes);
+    AddToCounter(BLOOM_HITS, num_bloom_hits);
+}
+
+void CountCandidateKmers(SparseHashMap& kmers,
+                         const FastqSequence* const sequence,
+                         const uint kmer_length) {
+    Kmer word, antiword, stored;
+    char buffer[65];
+    char* pbuffer = buffer;
+
+    if (sequence->slen < kmer_length) return;
+
+    // let account for all the kmers in this sequence
+    word = BuildIndex(sequence->bases, kmer_length);
+    uint num_kmers = strlen(sequence->bases) - kmer_length + 1;
+
+    for (uint i = 0; i < num_kmers; i++) {
+        word = GetNextKmer(word, sequence->bases, kmer_length, i);
+        antiword = ReverseComplementKmer(word, kmer_length);
+        stored = word < antiword ? word : antiword;
+
+        if (CheckKmerInSparseHashMap(kmers, stored) == TRUE) {
+            uint8_t old_kcnt = kmers[stored].count;
+            if (old_kcnt <= (umaxof(uint8_t) - 1)) {
+                kmers[stored].count += 1;
+            } else {
+                kmers[stored].count = umaxof(Kcount);
+            }
+            if (debug_flag == TRUE) {
+                ConvertKmerToString(word, kmer_length, &pbuffer);
+                buffer[kmer_length] = '\0';
+                PrintDebugMessage("2. Incrementing kmer %s count to %d",
+                                  buffer, kmers[stored].count);
+            }
+        }
+    }
+
+    AddToCounter(PASS2_READS, 1);
+    AddToCounter(PASS2_KMERS, num_kmers);
+    AddToCounter(HASH_PROBES, num_kmers);
+}
+
+void RemoveRareKmers(SparseHashMap& kmers,
+                     const uint min_threshold,
+                     const uint max_threshold) {
+    // go through and mark kmers as deleted if they occur less than a number of
+    // times
+    StartPhase(THRESHOLD_PHASE);
+    uint64_t num_removed = 0;
+    SparseHashMap::iterator it;
+    for (it = kmers.begin(); it != kmers.end(); it++) {
+        if (((*it).second.count < min_threshold) || ((*it).second.count > max_threshold))  {
+            kmers.erase(it);
+            num_removed++;
+        }
+    }
+    kmers.resize(0);
+    EndPhase(THRESHOLD_PHASE);
+
+    AddToCounter(KMERS_KEPT, kmers.size());
+    AddToCounter(KMERS_REMOVED, num_removed);
+}
+
+void WriteCandidateKmers(SparseHashMap& kmers,
+                         const BloomFilter* const singletons,
+                         const uint kmer_length,
+                         const char* const fname) {
+    FILE* fp = CkopenOrDie(fname, "wb");
+    uint32_t header[2] = {CANDIDATES_MAGIC, kmer_length};
+
+    if ((fwrite(header, sizeof(header), 1, fp) != 1) ||
+        (WriteBloomFilter(singletons, fp) == FALSE) ||
+        (kmers.serialize(SparseKmerSerializer(), fp) == false)) {
+        PrintMessageThenDie("Error in writing the kmers to %s", fname);
+    }
+    fclose(fp);
+    PrintDebugMessage("Wrote %zu candidate kmers to %s", kmers.size(), fname);
+}
+
+BloomFilter* ReadCandidateKmers(SparseHashMap& kmers,
+                                const uint kmer_length,
+                                const char* const fname) {
+    FILE* fp = CkopenOrDie(fname, "rb");
+    uint32_t header[2];
+    BloomFilter* singletons;
+
+    if ((fread(header, sizeof(header), 1, fp) != 1) ||
+        (header[0] != CANDIDATES_MAGIC)) {
+        PrintMessageThenDie("%s is not a file of candidate kmers", fname);
+    }
+    if (header[1] != kmer_length) {
+        PrintMessageThenDie("The kmers in %s are %u bps long, not %u",
+                            fname, header[1], kmer_length);
+    }
+    singletons = ReadBloomFilter(fp);
+    if (kmers.unserialize(SparseKmerSerializer(), fp) == false) {
+        PrintMessageThenDie("Error in reading the kmers from %s", fname);
+    }
+    fclose(fp);
+    PrintDebugMessage("Read %zu candidate kmers from %s", kmers.size(), fname);
+
+    return singletons;
+}
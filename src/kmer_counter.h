@@ -0,0 +1,73 @@
+#ifndef KMER_COUNTER_H_
+#define KMER_COUNTER_H_
+
+extern "C" {
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include <inttypes.h>
+
+#include "utilities.h"
+#include "kmer.h"
+#include "fastq_seq.h"
+#include "bloom_filter.h"
+#include "metrics.h"
+}
+
+#include "sparse_kmer_hash.h"
+
+// The kmers that are seen more than once in the reads are counted in two
+// passes over the reads. In the first pass every kmer is added to a Bloom
+// filter of the singletons, and the kmers that are already in the filter are
+// added to the table as candidates. In the second pass the candidates are
+// counted, and the false positives of the filter are removed along with the
+// other rare kmers. The first pass for a read does not depend on anything
+// else, so it can be done by any tool that reads the reads.
+
+// the size of the genome including the kmers that differ between haplotypes
+uint64_t ExpectedGenomeSize(const uint64_t haploid_genome_size,
+                            const uint kmer_length,
+                            const uint ploidy,
+                            const double heterozygosity);
+
+// the number of kmers we expect in a dataset, including the ones with errors
+uint64_t ExpectedNumberOfKmers(const uint64_t genome_size,
+                               const uint kmer_length,
+                               const uint expected_coverage,
+                               const double error_rate);
+
+// get an empty table ready for a genome of this size
+void InitKmerTable(SparseHashMap& kmers, const uint64_t genome_size);
+
+// the first pass for a read
+void AddCandidateKmers(SparseHashMap& kmers,
+                       BloomFilter* const singletons,
+                       const FastqSequence* const sequence,
+                       const uint kmer_length,
+                       const uint64_t num_expected_kmers);
+
+// the second pass for a read
+void CountCandidateKmers(SparseHashMap& kmers,
+                         const FastqSequence* const sequence,
+                         const uint kmer_length);
+
+// remove the kmers seen < min_threshold or > max_threshold times
+void RemoveRareKmers(SparseHashMap& kmers,
+                     const uint min_threshold,
+                     const uint max_threshold);
+
+// Write the candidates and the singletons after the first pass over some of
+// the reads to the file, so the rest of the counting can be done by another
+// tool.
+void WriteCandidateKmers(SparseHashMap& kmers,
+                         const BloomFilter* const singletons,
+                         const uint kmer_length,
+                         const char* const fname);
+
+// Read the candidates that were written for kmers of this length, and return
+// the singletons.
+BloomFilter* ReadCandidateKmers(SparseHashMap& kmers,
+                                const uint kmer_length,
+                                const char* const fname);
+
+#endif  // KMER_COUNTER_H_
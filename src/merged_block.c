@@ -0,0 +1,56 @@
+#include "merged_block.h"
+
+// make sure the buffer can hold a string of this length
+static void ReserveString(char** const buffer,
+                          size_t* const allocated,
+                          const size_t length) {
+    if (*allocated < length + 1) {
+        *allocated = length + 1;
+        *buffer = CkreallocOrDie(*buffer, *allocated);
+    }
+}
+
+void ReserveMergedBlock(MergedBlock* const block, const uint slen) {
+    if (block->allocated < slen + 1) {
+        block->allocated = slen + 1;
+        block->bases = CkreallocOrDie(block->bases, block->allocated);
+        block->quals = CkreallocOrDie(block->quals, block->allocated);
+    }
+}
+
+Bool ParseMergedBlock(MergedBlock* const block,
+                      const FastqSequence* const sequence) {
+    // the fields cannot be longer than the name
+    const size_t length = strlen(sequence->name);
+    ReserveString(&block->name, &block->name_allocated, length);
+    ReserveString(&block->copies, &block->copies_allocated, length);
+
+    if (sscanf(sequence->name, "@%s\t%6s\t%s\t%d\t%d\n",
+               block->name, block->motif, block->copies,
+               &block->zstart, &block->end) != 5) {
+        return FALSE;
+    }
+
+    ReserveMergedBlock(block, sequence->slen);
+    memcpy(block->bases, sequence->bases, sequence->slen);
+    memcpy(block->quals, sequence->quals, sequence->slen);
+    block->bases[sequence->slen] = '\0';
+    block->quals[sequence->slen] = '\0';
+    block->slen = sequence->slen;
+
+    return TRUE;
+}
+
+void WriteMergedBlock(FILE* const fp, const MergedBlock* const block) {
+    fprintf(fp, "@%s\t%s\t%s\t%d\t%d\n", block->name, block->motif,
+            block->copies, block->zstart, block->end);
+    fprintf(fp, "%s\n+\n%s\n", block->bases, block->quals);
+}
+
+void FreeMergedBlock(MergedBlock* const block) {
+    if (block->name) Ckfree(block->name);
+    if (block->copies) Ckfree(block->copies);
+    if (block->bases) Ckfree(block->bases);
+    if (block->quals) Ckfree(block->quals);
+    memset(block, 0, sizeof(MergedBlock));
+}
@@ -0,0 +1,39 @@
+#ifndef MERGED_BLOCK_H_
+#define MERGED_BLOCK_H_
+
+#include <stdio.h>
+
+#include "utilities.h"
+#include "fastq_seq.h"
+
+// A block of merged STR reads, as it is written by merge_STR_reads and read by
+// extend_STR_reads. The bases are the consensus of the reads in the block,
+// with the most copies of the motif that were seen in them.
+typedef struct MergedBlock_st {
+    char* name;               // the name of the block, without the @
+    size_t name_allocated;
+    char motif[7];
+    char* copies;             // the copy numbers of the alleles, e.g. 12,14
+    size_t copies_allocated;
+    int zstart, end;          // the location of the STR in the bases
+    char* bases;
+    char* quals;
+    size_t allocated;         // the room in the bases and in the quals
+    uint slen;
+} MergedBlock;
+
+// Make room for slen bases and quals in the block.
+void ReserveMergedBlock(MergedBlock* const block, const uint slen);
+
+// Fill the block from a read written by WriteMergedBlock. Returns FALSE if the
+// name of the read does not have the motif and the location of the STR.
+Bool ParseMergedBlock(MergedBlock* const block,
+                      const FastqSequence* const sequence);
+
+// write the block in fastq format
+void WriteMergedBlock(FILE* const fp, const MergedBlock* const block);
+
+// free the buffers of the block
+void FreeMergedBlock(MergedBlock* const block);
+
+#endif  // MERGED_BLOCK_H_
@@ -0,0 +1,174 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include "trace.h"
+
+// the names of the phases and the counters in the JSON
+static const char* const phase_names[NUM_PHASES] = {
+    "kmer_pass1",
+    "kmer_pass2",
+    "thresholding",
+    "unitigs",
+    "extension",
+    "merge",
+    "alignment"
+};
+
+static const char* const counter_names[NUM_COUNTERS] = {
+    "pass1_reads",
+    "pass1_kmers",
+    "pass2_reads",
+    "pass2_kmers",
+    "hash_probes",
+    "bloom_probes",
+    "bloom_hits",
+    "kmers_kept",
+    "kmers_removed",
+    "kmer_table_bytes",
+    "unitig_bytes",
+    "scanned_reads",
+    "merged_reads",
+    "alignments",
+    "merged_blocks",
+    "walks",
+    "walk_kmers",
+    "walk_probes",
+    "walk_dead_ends",
+    "walk_branches",
+    "walk_cycles",
+    "walk_length_limits",
+    "contigs"
+};
+
+typedef struct PhaseTimer_st {
+    uint64_t calls;
+    double wall;          // the time spent in the phase, in seconds
+    double cpu;
+    double start_wall;    // and when it was started the last time
+    double start_cpu;
+    clockid_t cpu_clock;  // the CPU clock it was started with
+    Bool is_thread;       // TRUE if that is the clock of a thread
+    Bool is_running;
+    size_t max_rss;       // the most resident memory at its end, in kB
+    uint64_t trace_start; // when it was started, in the time of the trace
+} PhaseTimer;
+
+static PhaseTimer phases[NUM_PHASES];
+static uint64_t counters[NUM_COUNTERS];
+static double run_start_wall;
+
+// The phases timed with the CPU time of their thread run along with the ones
+// timed with the CPU time of the process, which leave out that time so it is
+// not counted twice. This is the CPU time of those threads in the phases that
+// have ended.
+static double thread_phases_cpu = 0;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double ReadClock(const clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void InitMetrics(void) {
+    run_start_wall = ReadClock(CLOCK_MONOTONIC);
+}
+
+// The CPU time of the phase on its clock. The CPU time of the process leaves
+// out the time of the threads in the phases timed by their own clock, that
+// have ended or are running. The lock should be held.
+static double ReadPhaseClock(const PhaseTimer* const timer) {
+    double cpu = ReadClock(timer->cpu_clock);
+    if (timer->is_thread == TRUE) return cpu;
+
+    cpu -= thread_phases_cpu;
+    for (uint indx = 0; indx < NUM_PHASES; indx++) {
+        const PhaseTimer* const other = phases + indx;
+        if ((other->is_thread == TRUE) && (other->is_running == TRUE)) {
+            cpu -= ReadClock(other->cpu_clock) - other->start_cpu;
+        }
+    }
+    return cpu;
+}
+
+static void StartPhaseWithClock(const MetricPhase phase,
+                                const clockid_t cpu_clock,
+                                const Bool is_thread) {
+    PhaseTimer* const timer = phases + phase;
+    pthread_mutex_lock(&metrics_lock);
+    timer->cpu_clock = cpu_clock;
+    timer->is_thread = is_thread;
+    timer->start_wall = ReadClock(CLOCK_MONOTONIC);
+    timer->start_cpu = ReadPhaseClock(timer);
+    timer->is_running = TRUE;
+    pthread_mutex_unlock(&metrics_lock);
+    timer->trace_start = GetTraceTime();
+}
+
+void StartPhase(const MetricPhase phase) {
+    StartPhaseWithClock(phase, CLOCK_PROCESS_CPUTIME_ID, FALSE);
+}
+
+// The clock of the thread is used instead of CLOCK_THREAD_CPUTIME_ID, so the
+// other threads can read it while the phase is running.
+void StartThreadPhase(const MetricPhase phase) {
+    clockid_t cpu_clock;
+    if (pthread_getcpuclockid(pthread_self(), &cpu_clock) != 0) {
+        PrintThenDie("Error in reading the CPU clock of a thread");
+    }
+    StartPhaseWithClock(phase, cpu_clock, TRUE);
+}
+
+void EndPhase(const MetricPhase phase) {
+    PhaseTimer* const timer = phases + phase;
+    pthread_mutex_lock(&metrics_lock);
+    const double cpu = ReadPhaseClock(timer) - timer->start_cpu;
+    timer->wall += ReadClock(CLOCK_MONOTONIC) - timer->start_wall;
+    timer->cpu += cpu;
+    timer->is_running = FALSE;
+    if (timer->is_thread == TRUE) thread_phases_cpu += cpu;
+    pthread_mutex_unlock(&metrics_lock);
+    timer->calls++;
+    timer->max_rss = MAX(timer->max_rss, GetResidentMemory());
+    TraceSpan(phase_names[phase], timer->trace_start, NULL, 0);
+}
+
+void AddToCounter(const MetricCounter counter, const uint64_t value) {
+    __atomic_fetch_add(counters + counter, value, __ATOMIC_RELAXED);
+}
+
+void WriteMetrics(const char* const fname, const char* const program) {
+    FILE* fp = CkopenOrDie(fname, "w");
+    uint indx;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"program\": \"%s\",\n", program);
+    fprintf(fp, "  \"wall_seconds\": %.6f,\n",
+            ReadClock(CLOCK_MONOTONIC) - run_start_wall);
+    fprintf(fp, "  \"cpu_seconds\": %.6f,\n",
+            ReadClock(CLOCK_PROCESS_CPUTIME_ID));
+    fprintf(fp, "  \"rss_kb\": %zu,\n", GetResidentMemory());
+    fprintf(fp, "  \"peak_rss_kb\": %zu,\n", GetPeakResidentMemory());
+
+    fprintf(fp, "  \"phases\": {\n");
+    for (indx = 0; indx < NUM_PHASES; indx++) {
+        const PhaseTimer* const timer = phases + indx;
+        fprintf(fp, "    \"%s\": {\"calls\": %"PRIu64", \"wall_seconds\": %.6f, "
+                "\"cpu_seconds\": %.6f, \"max_rss_kb\": %zu}%s\n",
+                phase_names[indx], timer->calls, timer->wall, timer->cpu,
+                timer->max_rss, indx + 1 < NUM_PHASES ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+
+    fprintf(fp, "  \"counters\": {\n");
+    for (indx = 0; indx < NUM_COUNTERS; indx++) {
+        fprintf(fp, "    \"%s\": %"PRIu64"%s\n", counter_names[indx],
+                __atomic_load_n(counters + indx, __ATOMIC_RELAXED),
+                indx + 1 < NUM_COUNTERS ? "," : "");
+    }
+    fprintf(fp, "  }\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
@@ -0,0 +1,77 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include <inttypes.h>
+
+#include "utilities.h"
+
+// Where the time goes in a run, and how much work was done. Every phase has a
+// wall clock and a CPU timer, and is usually timed by the main thread with the
+// CPU time of the whole process, so the threads of the pool are included. A
+// phase that runs on a thread of its own, along with other phases, is timed
+// with the CPU time of that thread instead, which the phases timed with the
+// CPU time of the process leave out. The counters can be added to by any
+// thread. The metrics are written as JSON at the end of the run. When a trace
+// is being written, every phase is also an event on its timeline.
+
+typedef enum MetricPhase_em {
+    KMER_PASS1_PHASE,     // the first pass of the kmer counting
+    KMER_PASS2_PHASE,     // the second pass of the kmer counting
+    THRESHOLD_PHASE,      // removing the rare kmers
+    UNITIG_PHASE,         // the edges of the kmers and the unitigs
+    EXTENSION_PHASE,      // extending the blocks
+    MERGE_PHASE,          // merging the STR reads, including the alignments
+    ALIGNMENT_PHASE,      // merging the STR reads into the blocks
+    NUM_PHASES
+} MetricPhase;
+
+typedef enum MetricCounter_em {
+    PASS1_READS,          // the reads in the first pass of the kmer counting
+    PASS1_KMERS,          // and the kmers in them
+    PASS2_READS,          // the reads in the second pass
+    PASS2_KMERS,          // and the kmers in them
+    HASH_PROBES,          // lookups of a kmer in the table of kmers
+    BLOOM_PROBES,         // lookups of a kmer in the filter of singletons
+    BLOOM_HITS,           // and the ones that were found
+    KMERS_KEPT,           // the kmers left after the rare ones are removed
+    KMERS_REMOVED,        // and the ones that were removed
+    KMER_TABLE_BYTES,     // the kmers and their counts, without the table
+    UNITIG_BYTES,         // the unitigs, their bases and the used kmers
+    SCANNED_READS,        // the reads that were scanned for an STR
+    MERGED_READS,         // the STR reads that were merged
+    ALIGNMENTS,           // alignments of the flanks of a read to a block
+    MERGED_BLOCKS,        // the blocks that were passed on
+    WALKS,                // the walks that extended a block
+    WALK_KMERS,           // the kmers added by them
+    WALK_PROBES,          // lookups of a kmer that is not in a unitig
+    WALK_DEAD_ENDS,       // walks that stopped as there was no extension
+    WALK_BRANCHES,        // walks that stopped at a branch
+    WALK_CYCLES,          // walks that reached a kmer already in the walk
+    WALK_LENGTH_LIMITS,   // walks that reached the maximum extension
+    CONTIGS,              // the extended blocks that were printed
+    NUM_COUNTERS
+} MetricCounter;
+
+// remember when the run started
+void InitMetrics(void);
+
+// Start timing the phase. Only one thread should time a phase at a time.
+void StartPhase(const MetricPhase phase);
+
+// Same as above, but the CPU time is the one of the calling thread.
+void StartThreadPhase(const MetricPhase phase);
+
+// add the time since the phase started to it
+void EndPhase(const MetricPhase phase);
+
+// add the value to the counter
+void AddToCounter(const MetricCounter counter, const uint64_t value);
+
+// Write the phases, the counters and the memory used by the program to the
+// file as JSON.
+void WriteMetrics(const char* const fname, const char* const program);
+
+#endif  // METRICS_H_
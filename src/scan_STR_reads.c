@@ -0,0 +1,425 @@
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include <inttypes.h>
+#include <getopt.h>
+
+#include "utilities.h"
+#include "fastq_seq.h"
+#include "str_scanner.h"
+#include "thread_pool.h"
+#include "str_record.h"
+
+#ifndef VERSION
+#define VERSION ""
+#endif
+
+static const char* const usage =
+"Select and annotate reads that harbor a short tandem repeat.\n"
+"Version: %s\n"
+"\n"
+"    usage:\n"
+"        scan_STR_reads [options] reads1.fq reads2.fq ...\n"
+"        \n"
+"    where the options are:\n"
+"        -h,--help : print usage and quit.\n"
+"        -n,--numcopies: require at least this number of copies. [2]\n"
+"        -f,--flank: require >= these many bps around the STR on each side. [31]\n"
+"        -v,--version: print version and quit.\n"
+"        -2,--2mer : print reads that harbor only 2mers.\n"
+"        -3,--3mer : print reads that harbor only 3mers.\n"
+"        -4,--4mer : print reads that harbor only 4mers.\n"
+"        -5,--5mer : print reads that harbor only 5mers.\n"
+"        -6,--6mer : print reads that harbor only 6mers.\n"
+"        -r,--removehm: ignore STR that harbor homopolymer runs.\n"
+"        -p,--numprocesses: use these number of processes. [2]\n"
+"        -s,--chunksize: each process should be assigned chunk of reads. [100000]\n"
+"        -b,--binary: write the reads in the binary format of str_record.h.\n"
+"\n"
+"    This is a native version of select_STR_reads that finds all the STR's of\n"
+"    length 2-6 in a single pass over every read. It takes the same options\n"
+"    and prints the same reads as select_STR_reads.\n";
+
+static const struct option long_options[] = {
+    {"help",         no_argument,       NULL, 'h'},
+    {"debug",        no_argument,       NULL, 'd'},
+    {"numcopies",    required_argument, NULL, 'n'},
+    {"flanks",       required_argument, NULL, 'f'},
+    {"illumina",     no_argument,       NULL, 'i'},
+    {"check",        required_argument, NULL, 'c'},
+    {"version",      no_argument,       NULL, 'v'},
+    {"2mer",         no_argument,       NULL, '2'},
+    {"3mer",         no_argument,       NULL, '3'},
+    {"4mer",         no_argument,       NULL, '4'},
+    {"5mer",         no_argument,       NULL, '5'},
+    {"6mer",         no_argument,       NULL, '6'},
+    {"removehm",     no_argument,       NULL, 'r'},
+    {"altalgo",      no_argument,       NULL, 'x'},
+    {"numprocesses", required_argument, NULL, 'p'},
+    {"chunksize",    required_argument, NULL, 's'},
+    {"binary",       no_argument,       NULL, 'b'},
+    {NULL,           0,                 NULL, 0}
+};
+
+// complement the bases the way select_STR_reads does, leaving the other
+// characters as they are
+static const char* const rc_from = "atcgnATCGN";
+static const char* const rc_to   = "tagcnTAGCN";
+
+static void ReverseComplementBases(const char* const bases,
+                                   const uint slen,
+                                   char* const rc_bases) {
+    uint indx;
+    for (indx = 0; indx < slen; indx++) {
+        const char base = bases[slen - indx - 1];
+        const char* const found = strchr(rc_from, base);
+        rc_bases[indx] = (found && base) ? rc_to[found - rc_from] : base;
+    }
+    rc_bases[slen] = '\0';
+}
+
+// convert the bases to upper case, and make sure they are all ACGTN
+static void CheckBases(FastqSequence* const sequence) {
+    if (NormalizeBases(sequence->bases, sequence->slen) == FALSE) {
+        PrintMessageThenDie("read %s should only have ACGTN",
+                            sequence->name + 1);
+    }
+}
+
+// print the read with the STR on either strand in its name
+static void PrintSTRRead(const FastqSequence* const sequence,
+                         const char* const rc_bases,
+                         const TandemRepeat* const repeat,
+                         const TandemRepeat* const rc_repeat) {
+    printf("%s\t%.*s\t%u\t%u\t%u\t%.*s\t%u\t%u\t%u\n", sequence->name,
+           repeat->period, sequence->bases + repeat->zstart,
+           repeat->copies, repeat->zstart, repeat->end,
+           rc_repeat->period, rc_bases + rc_repeat->zstart,
+           rc_repeat->copies, rc_repeat->zstart, rc_repeat->end);
+    printf("%s\n", sequence->bases);
+    printf("+\n");
+    printf("%s\n", sequence->quals);
+}
+
+// the number of batches that are shared by the reader, the scanners and the
+// writer
+#define NUM_BATCHES 3
+
+// the reads in a batch are handed to the threads in blocks of these many
+#define SCAN_BLOCK_SIZE 256
+
+// a read in a batch, along with what we found on either strand
+typedef struct STRRead_st {
+    FastqSequence sequence;
+    char* rc_bases;
+    size_t rc_allocated;
+    TandemRepeat repeat;
+    TandemRepeat rc_repeat;
+    Bool selected;
+} STRRead;
+
+// a batch of consecutive reads from a file
+typedef struct ReadBatch_st {
+    STRRead* reads;
+    uint num_reads;
+    const char* done_file;  // the file that ends with this batch, if any
+} ReadBatch;
+
+// what the threads of the pipeline need
+typedef struct STRSelector_st {
+    char** fqnames;
+    uint num_files;
+    Bool illumina_quals;
+    uint chunksize;
+    uint num_threads;
+    const STRScanner* scanner;
+    RecordWriter* records;  // the reads are written here if they are binary
+    ReadBatch* scanning;    // the batch that is being scanned
+    BlockingQueue free;     // batches that can be filled
+    BlockingQueue filled;   // batches that have to be scanned
+    BlockingQueue scanned;  // batches that have to be printed
+} STRSelector;
+
+// copy length characters from str into the buffer, growing it if needed
+static void CopyIntoBuffer(char** const buffer,
+                           size_t* const allocated,
+                           const char* const str,
+                           const size_t length) {
+    if (*allocated < length + 1) {
+        *allocated = length + 1;
+        *buffer = CkreallocOrDie(*buffer, *allocated);
+    }
+    memcpy(*buffer, str, length);
+    (*buffer)[length] = '\0';
+}
+
+// Read the files in batches of chunksize reads. The batches are reused once
+// they have been printed.
+static void* ReadBatches(void* arg) {
+    STRSelector* const selector = (STRSelector*)arg;
+    uint findex;
+
+    for (findex = 0; findex < selector->num_files; findex++) {
+        const char* const fqname = selector->fqnames[findex];
+        FastqSequence* sequence = 
+            ReadFastqSequence(fqname, selector->illumina_quals, FALSE);
+
+        do {
+            ReadBatch* const batch = PopFromQueue(&selector->free);
+            batch->num_reads = 0;
+            batch->done_file = NULL;
+
+            while ((sequence != NULL) &&
+                   (batch->num_reads < selector->chunksize)) {
+                CheckBases(sequence);
+
+                FastqSequence* const copy = 
+                    &batch->reads[batch->num_reads++].sequence;
+                CopyIntoBuffer(&copy->name, &copy->name_length,
+                               sequence->name, strlen(sequence->name));
+                CopyIntoBuffer(&copy->bases, &copy->bases_length,
+                               sequence->bases, sequence->slen);
+                CopyIntoBuffer(&copy->quals, &copy->quals_length,
+                               sequence->quals, sequence->slen);
+                copy->slen = sequence->slen;
+
+                sequence = GetNextSequence(sequence);
+            }
+            if (sequence == NULL) batch->done_file = fqname;
+
+            PushToQueue(&selector->filled, batch);
+        } while (sequence != NULL);
+    }
+    PushToQueue(&selector->filled, NULL);
+
+    return NULL;
+}
+
+// Scan a block of the reads in the batch. The STR has to be found on both the
+// strands. This is called by the threads in the pool.
+static void ScanBlockOfReads(void* const arg,
+                             const uint64_t item,
+                             const uint thread UNUSED) {
+    STRSelector* const selector = (STRSelector*)arg;
+    ReadBatch* const batch = selector->scanning;
+    uint indx = item * SCAN_BLOCK_SIZE;
+    const uint end = MIN(indx + SCAN_BLOCK_SIZE, batch->num_reads);
+
+    for (; indx < end; indx++) {
+        STRRead* const read = batch->reads + indx;
+        const FastqSequence* const sequence = &read->sequence;
+
+        read->selected = FindBestTandemRepeats(selector->scanner,
+                                               sequence->bases, sequence->slen,
+                                               &read->repeat, &read->rc_repeat);
+        if ((read->selected == FALSE) || (selector->records != NULL)) continue;
+
+        // the reverse complement is only needed to print the read
+        if (read->rc_allocated < sequence->slen + 1) {
+            read->rc_allocated = sequence->slen + 1;
+            read->rc_bases = CkreallocOrDie(read->rc_bases, read->rc_allocated);
+        }
+        ReverseComplementBases(sequence->bases, sequence->slen, read->rc_bases);
+    }
+}
+
+// Print or write the selected reads in the batches, in the order they were
+// read.
+static void* WriteBatches(void* arg) {
+    STRSelector* const selector = (STRSelector*)arg;
+    ReadBatch* batch;
+    uint indx;
+
+    while ((batch = PopFromQueue(&selector->scanned)) != NULL) {
+        for (indx = 0; indx < batch->num_reads; indx++) {
+            const STRRead* const read = batch->reads + indx;
+            if (read->selected == FALSE) continue;
+
+            if (selector->records != NULL) {
+                WriteSTRReadRecord(selector->records, &read->sequence,
+                                   &read->repeat, &read->rc_repeat);
+            } else {
+                PrintSTRRead(&read->sequence, read->rc_bases, &read->repeat,
+                             &read->rc_repeat);
+            }
+        }
+        if (batch->done_file) {
+            fflush(stdout);
+            fprintf(stderr, "Done processing %s\n", batch->done_file);
+        }
+
+        PushToQueue(&selector->free, batch);
+    }
+
+    return NULL;
+}
+
+// The reads are read, scanned and printed by different threads, so reading
+// and printing a batch overlaps with scanning the one before it. The batches
+// are scanned one after the other by num_threads threads, and are printed in
+// the order they were read. The reads are printed in fastq format, unless
+// write_binary is TRUE.
+static void ScanShortTandemRepeatReads(char** const fqnames,
+                                       const uint num_files,
+                                       const STRScanner* const scanner,
+                                       const Bool illumina_quals,
+                                       const uint num_threads,
+                                       const uint chunksize,
+                                       const Bool write_binary) {
+    STRSelector selector;
+    ReadBatch batches[NUM_BATCHES];
+    pthread_t reader, writer;
+    ReadBatch* batch;
+    uint indx, rindx;
+
+    memset(&selector, 0, sizeof(STRSelector));
+    selector.fqnames = fqnames;
+    selector.num_files = num_files;
+    selector.illumina_quals = illumina_quals;
+    selector.chunksize = chunksize;
+    selector.num_threads = num_threads;
+    selector.scanner = scanner;
+    if (write_binary == TRUE) {
+        selector.records = NewRecordWriter(stdout, STR_READ_RECORDS);
+    }
+    InitBlockingQueue(&selector.free, NUM_BATCHES + 1);
+    InitBlockingQueue(&selector.filled, NUM_BATCHES + 1);
+    InitBlockingQueue(&selector.scanned, NUM_BATCHES + 1);
+
+    for (indx = 0; indx < NUM_BATCHES; indx++) {
+        batches[indx].reads = CkalloczOrDie(chunksize * sizeof(STRRead));
+        batches[indx].num_reads = 0;
+        batches[indx].done_file = NULL;
+        PushToQueue(&selector.free, batches + indx);
+    }
+
+    if ((pthread_create(&reader, NULL, ReadBatches, &selector) != 0) ||
+        (pthread_create(&writer, NULL, WriteBatches, &selector) != 0)) {
+        PrintThenDie("Error in creating a thread");
+    }
+
+    while ((batch = PopFromQueue(&selector.filled)) != NULL) {
+        selector.scanning = batch;
+        RunWorkStealingPool((batch->num_reads + SCAN_BLOCK_SIZE - 1) / 
+                            SCAN_BLOCK_SIZE, 
+                            num_threads, ScanBlockOfReads, &selector);
+        PushToQueue(&selector.scanned, batch);
+    }
+    PushToQueue(&selector.scanned, NULL);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    for (indx = 0; indx < NUM_BATCHES; indx++) {
+        for (rindx = 0; rindx < chunksize; rindx++) {
+            STRRead* const read = batches[indx].reads + rindx;
+            if (read->sequence.name) Ckfree(read->sequence.name);
+            if (read->sequence.bases) Ckfree(read->sequence.bases);
+            if (read->sequence.quals) Ckfree(read->sequence.quals);
+            if (read->rc_bases) Ckfree(read->rc_bases);
+        }
+        Ckfree(batches[indx].reads);
+    }
+    FreeBlockingQueue(&selector.free);
+    FreeBlockingQueue(&selector.filled);
+    FreeBlockingQueue(&selector.scanned);
+    if (selector.records != NULL) FreeRecordWriter(&selector.records);
+}
+
+int main(int argc, char** argv) {
+    // start time management
+    t0 = time(0);
+
+    uint num_minimum_copies = 2;
+    uint flanking_distance = 31;
+    Bool illumina_quals = FALSE;
+    Bool remove_homopolymers = FALSE;
+    Bool altalgo = TRUE;
+    Bool debug_flag = FALSE;
+    Bool write_binary = FALSE;
+    int num_processes = 2;
+    int chunksize = 100000;
+    char periods[MAX_PERIOD + 1] = "";
+    int option;
+
+    while ((option = getopt_long(argc, argv, "hdn:f:ic:v23456rxp:s:b",
+                                 long_options, NULL)) != -1) {
+        switch (option) {
+            case 'h':
+                fprintf(stderr, usage, VERSION);
+                return EXIT_SUCCESS;
+            case 'd':
+                debug_flag = TRUE;
+                break;
+            case 'n':
+                num_minimum_copies = atoi(optarg);
+                break;
+            case 'f':
+                flanking_distance = atoi(optarg);
+                break;
+            case 'i':
+                illumina_quals = TRUE;
+                break;
+            case 'c':
+                PrintWarning("Ignoring --check=%s, it is only supported by "
+                             "select_STR_reads", optarg);
+                break;
+            case 'v':
+                fprintf(stderr, "Program: scan_STR_reads\n");
+                fprintf(stderr, "Version: %s\n", VERSION);
+                fprintf(stderr, "Contact: Aakrosh Ratan (ratan@bx.psu.edu)\n");
+                return EXIT_SUCCESS;
+            case '2': case '3': case '4': case '5': case '6':
+                if (strchr(periods, option) == NULL) {
+                    periods[strlen(periods)] = option;
+                }
+                break;
+            case 'r':
+                remove_homopolymers = TRUE;
+                break;
+            case 'x':
+                altalgo = FALSE;
+                break;
+            case 'p':
+                num_processes = atoi(optarg);
+                break;
+            case 's':
+                chunksize = atoi(optarg);
+                break;
+            case 'b':
+                write_binary = TRUE;
+                break;
+            default:
+                fprintf(stderr, usage, VERSION);
+                return 2;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, usage, VERSION);
+        return 3;
+    }
+    // a single copy of the motif is always there
+    if (num_minimum_copies == 0) num_minimum_copies = 1;
+
+    STRScanner* scanner = NewSTRScanner(num_minimum_copies, flanking_distance,
+                                        periods, remove_homopolymers, altalgo);
+    if (debug_flag == TRUE) {
+        PrintDebugMessage("Comparing the bases with the %s kernel",
+                          scanner->kernel);
+    }
+
+    if (num_processes <= 0) {
+        PrintThenDie("The number of processes should be at least 1");
+    }
+    if (chunksize <= 0) {
+        PrintThenDie("The chunk of reads should have at least one read");
+    }
+
+    ScanShortTandemRepeatReads(argv + optind, argc - optind, scanner,
+                               illumina_quals, num_processes, chunksize,
+                               write_binary);
+    FreeSTRScanner(&scanner);
+
+    return EXIT_SUCCESS;
+}
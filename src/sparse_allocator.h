@@ -0,0 +1,85 @@
+#ifndef SPARSE_ALLOCATOR_H_
+#define SPARSE_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <new>
+#include <sparsehash/sparse_hash_map>
+
+extern "C" {
+#include "utilities.h"
+}
+
+// The hash maps use the allocator of sparsehash, which reallocates its groups
+// in place. In a profile build (-DProfileMemory) they go through the wrappers
+// in utilities.h instead, so the memory of a map is charged to the line that
+// names it, and the kmer table and the blocks are in the report.
+
+// a line that the memory of a hash map is charged to
+#define ALLOCATION_SITE(name)                                  \
+    struct name {                                              \
+        static const char* Filename() { return __FILE__; }     \
+        static uint Linenum() { return __LINE__; }             \
+    }
+
+template <class T, class Site>
+class CkAllocator {
+  public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind {
+        typedef CkAllocator<U, Site> other;
+    };
+
+    CkAllocator() {}
+    CkAllocator(const CkAllocator&) {}
+    template <class U>
+    CkAllocator(const CkAllocator<U, Site>&) {}
+
+    pointer address(reference x) const { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+
+    pointer allocate(const size_type n, const void* = 0) {
+        return static_cast<pointer>(_ckalloc(n * sizeof(T), Site::Filename(),
+                                             Site::Linenum()));
+    }
+
+    void deallocate(pointer p, const size_type) {
+        _ckfree(p, Site::Filename(), Site::Linenum());
+    }
+
+    size_type max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+
+    void construct(pointer p, const T& value) { new(p) T(value); }
+    void destroy(pointer p) { p->~T(); }
+};
+
+template <class T, class U, class Site>
+inline bool operator==(const CkAllocator<T, Site>&,
+                       const CkAllocator<U, Site>&) {
+    return true;
+}
+
+template <class T, class U, class Site>
+inline bool operator!=(const CkAllocator<T, Site>&,
+                       const CkAllocator<U, Site>&) {
+    return false;
+}
+
+// the allocator of a hash map with values of type T, charged to Site
+template <class T, class Site>
+struct SparseAllocator {
+#ifdef ProfileMemory
+    typedef CkAllocator<T, Site> type;
+#else
+    typedef google::libc_allocator_with_realloc<T> type;
+#endif
+};
+
+#endif  // SPARSE_ALLOCATOR_H_
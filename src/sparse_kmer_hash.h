@@ -9,6 +9,8 @@
 
 #include <iostream>
 
+#include "sparse_allocator.h"
+
 extern "C" {
 #include "kmer.h"
 #include "murmur_hash.h"
@@ -77,10 +79,14 @@ struct SparseKmerSerializer {
     }
 };
 
-typedef sparse_hash_map<Kmer,Kcount,SparseMurmurHasher<Kmer>, SparseEqKmer> SparseHashMap;
+ALLOCATION_SITE(KmerTableSite);
+
+typedef sparse_hash_map<Kmer,Kcount,SparseMurmurHasher<Kmer>, SparseEqKmer,
+    SparseAllocator<std::pair<const Kmer, Kcount>, KmerTableSite>::type>
+    SparseHashMap;
 
-Bool CheckKmerInSparseHashMap(SparseHashMap& kmers,
-                              const Kmer kmer) {
+inline Bool CheckKmerInSparseHashMap(SparseHashMap& kmers,
+                                     const Kmer kmer) {
     SparseHashMap::iterator it;
     it = kmers.find(kmer);
 
@@ -10,7 +10,10 @@
 
 #include <iostream>
 
+#include "sparse_allocator.h"
+
 extern "C" {
+#include "kmer.h"
 #include "murmur_hash.h"
 }
 
@@ -18,15 +21,20 @@ using google::sparse_hash_map;      // namespace where class lives by default
 using std::cout;
 using std::endl;
 
+// the number of reads in a block that support this many copies of the motif
 typedef struct Copies_st
 {
-    struct Copies_st* next;
     uint16_t copies;
     uint16_t nsupport;
-    // char name1[1024];
-    // char name2[1024];
 } Copies;
 
+// most blocks see only a few different copy numbers, so those are kept in the
+// block itself
+#define INLINE_COPIES 4
+
+// A block and its sequence are allocated from an arena. The seq and qual have
+// room for allocated bytes each, so the consensus is usually updated in place.
+// The copy numbers are in the order they were first seen.
 typedef struct Block_st
 {
     struct Block_st* next;
@@ -34,35 +42,69 @@ typedef struct Block_st
     uint16_t end;
     uint16_t slen;
     uint16_t support;
+    uint16_t num_supports;
+    uint16_t allocated_supports;
+    uint allocated;
     Copies* supports;
     char* seq;
     char* qual;
+    Copies inline_supports[INLINE_COPIES];
 } Block;
 
-struct eqstr
+// The key for the blocks of an STR: the motif packed with 2 bits per base, its
+// length, and the klength bases on either side of the STR.
+typedef struct BlockKey_st {
+    Kmer lflank;
+    Kmer rflank;
+    uint16_t motif;
+    uint16_t motif_length;
+} BlockKey;
+
+// mix the bits of the word, with the finalizer from MurmurHash3
+static inline uint64_t MixBits(uint64_t word)
+{
+    word ^= word >> 33;
+    word *= 0xff51afd7ed558ccdULL;
+    word ^= word >> 33;
+    word *= 0xc4ceb9fe1a85ec53ULL;
+    word ^= word >> 33;
+    return word;
+}
+
+static inline uint64_t KmerBits(const Kmer kmer)
 {
-  bool operator()(const char* s1, const char* s2) const
-  {
-    return (s1 == s2) || (s1 && s2 && strcmp(s1, s2) == 0);
-  }
+#ifdef Large
+    return (uint64_t)kmer ^ MixBits((uint64_t)(kmer >> 64));
+#else
+    return kmer;
+#endif
+}
+
+struct BlockKeyHasher {
+    size_t operator()(const BlockKey& key) const {
+        uint64_t hashVal = MixBits(KmerBits(key.lflank));
+        hashVal = MixBits(hashVal ^ KmerBits(key.rflank));
+        return MixBits(hashVal ^ ((uint64_t)key.motif_length << 16 | key.motif));
+    }
 };
 
-struct MurmurHasher {
-    size_t operator()(const char* t) const {
-        uint128_t hashVal;
-        if (MurmurHash3_128(t, strlen(t), 0, &hashVal) == false)
-            PrintThenDie("error in determining the hash");
-        return hashVal;
+struct BlockKeyEq {
+    bool operator()(const BlockKey& k1, const BlockKey& k2) const {
+        return (k1.lflank == k2.lflank) && (k1.rflank == k2.rflank) &&
+               (k1.motif == k2.motif) && (k1.motif_length == k2.motif_length);
     }
 };
 
+ALLOCATION_SITE(BlockMapSite);
 
-typedef sparse_hash_map<const char* , Block*, MurmurHasher, eqstr> SparseWordHashMap;
+typedef sparse_hash_map<BlockKey, Block*, BlockKeyHasher, BlockKeyEq,
+    SparseAllocator<std::pair<const BlockKey, Block*>, BlockMapSite>::type> 
+    SparseBlockHashMap;
 
-Bool CheckInSparseWordHashMap(SparseWordHashMap& blocks,
-                         const char* key) 
+Bool CheckInSparseBlockHashMap(SparseBlockHashMap& blocks,
+                               const BlockKey& key) 
 {
-    SparseWordHashMap::iterator it;
+    SparseBlockHashMap::iterator it;
     it = blocks.find(key);
 
     if (it == blocks.end()) {
@@ -0,0 +1,1926 @@
+#include "str_extender.h"
+
+extern "C" {
+#include <pthread.h>
+
+#include "kmer.h"
+#include "thread_pool.h"
+#include "trace.h"
+}
+
+extern Bool debug_flag;
+
+// the maximum extension
+static uint flank_chunk = 1024;
+
+// the longest indel that an extension can go through
+static uint max_indel = 0;
+
+// the edge mask of a kmer stores the predecessors in the lower nibble and the
+// successors in the upper nibble.
+#define Predecessors(edges) ((edges) & 0xF)
+#define Successors(edges)   ((edges) >> 4)
+
+// move bit b of a nibble to bit 3 - b. This is how the predecessors and the
+// successors of a kmer are related to those of its reverse complement.
+static const uint8_t nibble_reverse[16] = {
+    0x0, 0x8, 0x4, 0xC, 0x2, 0xA, 0x6, 0xE,
+    0x1, 0x9, 0x5, 0xD, 0x3, 0xB, 0x7, 0xF
+};
+
+static void RvKmers(Kmer word, 
+                    Kmer* const rvs, 
+                    const uint kmer_length) {
+    Kmer indx = 0;
+    for (indx = 0; indx < 4; indx++) {
+        Kmer right_shifted = word >> 2;
+        Kmer to_add = (indx <<  (2*kmer_length - 2));
+        rvs[indx] = right_shifted + to_add;
+    }    
+}
+
+static void FwKmers(Kmer word,
+                    Kmer* const fws,
+                    const uint kmer_length) {
+    Kmer indx = 0;
+    for (indx = 0; indx < 4; indx++) {
+        Kmer left_shifted = (word << ((8 * sizeof(Kmer)) - 2*kmer_length + 2));
+        Kmer right_shifted = (left_shifted >>((8 * sizeof(Kmer))-2*kmer_length));
+        right_shifted += indx;
+        fws[indx] = right_shifted;
+    }
+}
+
+// return the edge mask of the kmer (in the orientation provided) by looking up
+// all its 8 possible neighbours in the hash.
+static uint8_t ProbeKmerEdges(SparseHashMap& kmers,
+                              const Kmer kmer,
+                              const uint kmer_length) {
+    Kmer rvs[4], fws[4];
+    Kmer antiword, stored;
+    uint8_t edges = 0;
+    uint indx;
+
+    RvKmers(kmer, rvs, kmer_length);
+    FwKmers(kmer, fws, kmer_length);
+
+    for (indx = 0; indx < 4; indx++) {
+        antiword = ReverseComplementKmer(rvs[indx], kmer_length);
+        stored = rvs[indx] < antiword ? rvs[indx] : antiword;
+        if (CheckKmerInSparseHashMap(kmers, stored) == TRUE) {
+            edges |= (1 << indx);
+        }
+
+        antiword = ReverseComplementKmer(fws[indx], kmer_length);
+        stored = fws[indx] < antiword ? fws[indx] : antiword;
+        if (CheckKmerInSparseHashMap(kmers, stored) == TRUE) {
+            edges |= (1 << (indx + 4));
+        }
+    }
+
+    return edges;
+}
+
+// once the solid kmers are known, store the edge mask with each one of them so
+// that every step of an extension is a single lookup.
+static void ComputeKmerEdges(SparseHashMap& kmers, const uint kmer_length) {
+    SparseHashMap::iterator it;
+    for (it = kmers.begin(); it != kmers.end(); it++) {
+        (*it).second.edges = ProbeKmerEdges(kmers, (*it).first, kmer_length);
+    }
+}
+
+// return the edge mask of the kmer in the orientation provided. We only probe
+// the neighbours if the kmer is not solid itself, which can happen for the
+// first kmer of an extension.
+static uint8_t GetKmerEdges(SparseHashMap& kmers,
+                            const Kmer kmer,
+                            const uint kmer_length) {
+    Kmer antiword = ReverseComplementKmer(kmer, kmer_length);
+    Bool is_canonical = kmer < antiword;
+
+    SparseHashMap::iterator it = kmers.find(is_canonical ? kmer : antiword);
+    if (it == kmers.end()) {
+        return ProbeKmerEdges(kmers, kmer, kmer_length);
+    }
+
+    uint8_t edges = (*it).second.edges;
+    if (is_canonical == TRUE) return edges;
+    return nibble_reverse[Successors(edges)] | 
+          (nibble_reverse[Predecessors(edges)] << 4);
+}
+
+// return the base for the extension out of the ones set in mask. If both
+// branches of a SNP are valid, then we select the branch we have always
+// selected, i.e. the one that is checked last when the neighbours are checked
+// in the order rvs[0], fws[0], rvs[1], ..., fws[3]. Its position in that
+// order depends on whether the neighbour is stored as is, or as its reverse
+// complement.
+static uint SelectExtensionBase(const Kmer* const neighbours,
+                                const uint8_t mask,
+                                const Bool is_backward,
+                                const uint kmer_length) {
+    if (__builtin_popcount(mask) == 1) return __builtin_ctz(mask);
+
+    uint indx, best = 0, rank, best_rank = 0;
+    for (indx = 0; indx < 4; indx++) {
+        if ((mask & (1 << indx)) == 0) continue;
+
+        Bool is_canonical = neighbours[indx] < 
+                            ReverseComplementKmer(neighbours[indx],kmer_length);
+        if (is_backward == TRUE) {
+            rank = is_canonical ? 2 * indx : 7 - 2 * indx;
+        } else {
+            rank = is_canonical ? 2 * indx + 1 : 6 - 2 * indx;
+        }
+        if (rank >= best_rank) {
+            best_rank = rank;
+            best = indx;
+        }
+    }
+    return best;
+}
+
+// kmers that are not part of any unitig
+#define NO_UNITIG 0xFFFFFFFF
+
+// the highest bit of a link is set if the kmer entered is reverse complemented
+// in its unitig
+#define REVERSED_IN_UNITIG 0x80000000
+
+// The position of a kmer that is not part of any unitig. The highest of the 48
+// bits of a position is set if the canonical kmer is reverse complemented in
+// its unitig.
+#define NO_POSITION       0x7FFFFFFFFFFFULL
+#define REVERSED_POSITION 0x800000000000ULL
+
+// A unitig is a maximal path in the de Bruijn graph of the solid kmers where
+// every kmer is the only successor of the previous kmer, and the previous
+// kmer is the only predecessor of the kmer. The kmers of a unitig are stored
+// in the orientation they are read in the bases of the unitig.
+//
+// A unitig can only be entered or left at its first or its last kmer, so we
+// store the edges of those two kmers, and the unitigs they lead to. links[0][b]
+// is the unitig entered when the first kmer is extended backward with base b,
+// and links[1][b] is the one entered when the last kmer is extended forward
+// with base b (both in the orientation of the unitig). REVERSED_IN_UNITIG is
+// set in a link if the kmer entered is read reverse complemented in its unitig.
+//
+// What an extension does when it leaves the unitig from one of its ends only
+// depends on the graph around that end, so it is decided once and remembered
+// in exits[] for all the extensions that reach the same end.
+typedef struct Unitig_st {
+    uint64_t zstart;       // start of the bases of the unitig in unitig_bases
+    uint32_t length;       // number of kmers in the unitig
+    uint8_t edges[2];      // edges of the first and the last kmer
+    uint8_t exits[2];      // what to do when leaving from the first/last kmer
+    uint32_t links[2][4];  // the unitigs entered from the first and last kmer
+} Unitig;
+
+// what an extension does when it reaches a kmer. The base is stored in the
+// lower 2 bits of EXIT_BASE.
+#define EXIT_UNKNOWN  0x00  // not decided yet
+#define EXIT_DEAD_END 0x10  // there is no extension
+#define EXIT_BRANCHES 0x20  // more than one extension, which is not a SNP
+#define EXIT_BASE     0x40  // extend with the base
+
+// all the unitigs, and the bases spelled by them
+Unitig* unitigs = NULL;
+uint32_t num_unitigs = 0;
+uint32_t unitigs_allocated = 0;
+char* unitig_bases = NULL;
+uint64_t num_unitig_bases = 0;
+uint64_t unitig_bases_allocated = 0;
+
+static uint64_t GetKmerPosition(const Kcount* const kcount) {
+    return ((uint64_t)kcount->position_high << 32) | kcount->position_low;
+}
+
+static void SetKmerPosition(Kcount* const kcount, const uint64_t position) {
+    kcount->position_high = (uint16_t)(position >> 32);
+    kcount->position_low = (uint32_t)position;
+}
+
+// the index of the kmer at this offset in the unitig, among all the kmers of
+// all the unitigs
+static uint64_t KmerIndexInUnitigs(const uint32_t unitig,
+                                   const uint32_t offset,
+                                   const uint kmer_length) {
+    return unitigs[unitig].zstart - (uint64_t)unitig * (kmer_length - 1) + 
+           offset;
+}
+
+// the unitig with the kmer at this index. The unitigs are stored in the order
+// of their bases, so their first kmers are in increasing order.
+static uint32_t FindUnitigOfKmer(const uint64_t kindx, const uint kmer_length) {
+    uint32_t lo = 0, hi = num_unitigs - 1, mid;
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (KmerIndexInUnitigs(mid, 0, kmer_length) <= kindx) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// the position of a kmer (in the orientation provided) in the de Bruijn graph
+typedef struct KmerNode_st {
+    uint8_t edges;    // the edges in the orientation provided
+    uint32_t unitig;  // NO_UNITIG if the kmer is not solid
+    uint32_t offset;  // the offset of the kmer in the unitig
+    Bool is_forward;  // TRUE if the kmer is read as is in the unitig
+} KmerNode;
+
+static void GetKmerNode(SparseHashMap& kmers,
+                        const Kmer kmer,
+                        const uint kmer_length,
+                        KmerNode* const node) {
+    Kmer antiword = ReverseComplementKmer(kmer, kmer_length);
+    Bool is_canonical = kmer < antiword;
+
+    SparseHashMap::iterator it = kmers.find(is_canonical ? kmer : antiword);
+    if (it == kmers.end()) {
+        node->edges = ProbeKmerEdges(kmers, kmer, kmer_length);
+        node->unitig = NO_UNITIG;
+        node->offset = 0;
+        node->is_forward = TRUE;
+        return;
+    }
+
+    uint8_t edges = (*it).second.edges;
+    if (is_canonical == FALSE) {
+        edges = nibble_reverse[Successors(edges)] | 
+               (nibble_reverse[Predecessors(edges)] << 4);
+    }
+    node->edges = edges;
+
+    const uint64_t position = GetKmerPosition(&(*it).second);
+    if (position == NO_POSITION) {
+        node->unitig = NO_UNITIG;
+        node->offset = 0;
+        node->is_forward = TRUE;
+        return;
+    }
+    const uint64_t kindx = position & ~REVERSED_POSITION;
+    node->unitig = FindUnitigOfKmer(kindx, kmer_length);
+    node->offset = kindx - KmerIndexInUnitigs(node->unitig, 0, kmer_length);
+    node->is_forward = ((position & REVERSED_POSITION) == 0) == is_canonical;
+}
+
+// return the kmer at this offset in the unitig, in the orientation requested
+static Kmer GetKmerInUnitig(const Unitig* const unitig,
+                            const uint32_t offset,
+                            const Bool is_forward,
+                            const uint kmer_length) {
+    Kmer word = ConvertStringToKmer(unitig_bases + unitig->zstart + offset, 
+                                    kmer_length);
+    return is_forward ? word : ReverseComplementKmer(word, kmer_length);
+}
+
+// the work assigned to a thread while building the unitigs
+typedef struct UnitigBuilder_st {
+    SparseHashMap* kmers;
+    uint kmer_length;
+
+    // the kmers that are checked for being the start of a unitig 
+    const Kmer* keys;
+    uint64_t zstart;
+    uint64_t end;
+
+    // the unitigs found by this thread
+    Unitig* unitigs;
+    uint32_t num_unitigs;
+    uint32_t unitigs_allocated;
+    char* bases;
+    uint64_t num_bases;
+    uint64_t bases_allocated;
+} UnitigBuilder;
+
+// return TRUE if the kmer (in the orientation provided) is followed by another
+// kmer in the same unitig, which is returned in next.
+static Bool HasUnitigSuccessor(SparseHashMap& kmers,
+                               const Kmer kmer,
+                               const uint kmer_length,
+                               Kmer* const next) {
+    uint8_t succs = Successors(GetKmerEdges(kmers, kmer, kmer_length));
+    if (__builtin_popcount(succs) != 1) return FALSE;
+
+    Kmer fws[4];
+    FwKmers(kmer, fws, kmer_length);
+    Kmer succ = fws[__builtin_ctz(succs)];
+
+    // a kmer that loops onto itself or onto its reverse complement ends the
+    // unitig
+    if ((succ == kmer) || (succ == ReverseComplementKmer(kmer, kmer_length))) {
+        return FALSE;
+    }
+
+    uint8_t preds = Predecessors(GetKmerEdges(kmers, succ, kmer_length));
+    if (__builtin_popcount(preds) != 1) return FALSE;
+
+    *next = succ;
+    return TRUE;
+}
+
+// add bases to a growing buffer of bases
+static void AddUnitigBases(char** pbases,
+                           uint64_t* const num_bases,
+                           uint64_t* const bases_allocated,
+                           const char* const bases,
+                           const uint64_t length) {
+    if (*num_bases + length > *bases_allocated) {
+        *bases_allocated = (*num_bases + length) * 2;
+        *pbases = (char*)CkreallocOrDie(*pbases, *bases_allocated);
+    }
+    memcpy(*pbases + *num_bases, bases, length);
+    *num_bases += length;
+}
+
+// add a unitig to a growing list of unitigs
+static void AddUnitig(Unitig** punitigs,
+                      uint32_t* const num,
+                      uint32_t* const allocated,
+                      const uint64_t zstart,
+                      const uint32_t length) {
+    if (*num == *allocated) {
+        *allocated = *allocated == 0 ? 1024 : *allocated * 2;
+        *punitigs = (Unitig*)CkreallocOrDie(*punitigs, 
+                                            *allocated * sizeof(Unitig));
+    }
+    (*punitigs)[*num].zstart = zstart;
+    (*punitigs)[*num].length = length;
+    *num += 1;
+}
+
+// Walk every unitig that starts at one of the kmers (in either orientation)
+// assigned to this thread. A unitig is walked from both its ends, so we only
+// keep it when it is walked from the end that is smaller than the reverse
+// complement of the other end.
+static void* FindUnitigs(void* arg) {
+    UnitigBuilder* builder = (UnitigBuilder*)arg;
+    SparseHashMap& kmers = *(builder->kmers);
+    const uint kmer_length = builder->kmer_length;
+
+    char* buffer = (char*)CkalloczOrDie(kmer_length + 1);
+    Kmer start, curr, next;
+    uint64_t indx;
+    uint orientation;
+
+    for (indx = builder->zstart; indx < builder->end; indx++) {
+        for (orientation = 0; orientation < 2; orientation++) {
+            start = builder->keys[indx];
+            if (orientation == 1) {
+                start = ReverseComplementKmer(start, kmer_length);
+            }
+
+            // this kmer is not the start of a unitig if its predecessor is in
+            // the same unitig
+            if (HasUnitigSuccessor(kmers, 
+                                   ReverseComplementKmer(start, kmer_length),
+                                   kmer_length,
+                                   &next) == TRUE) {
+                continue;
+            }
+
+            uint64_t zstart = builder->num_bases;
+            uint32_t length = 1;
+            ConvertKmerToString(start, kmer_length, &buffer);
+            AddUnitigBases(&builder->bases, &builder->num_bases, 
+                           &builder->bases_allocated, buffer, kmer_length);
+
+            curr = start;
+            while (HasUnitigSuccessor(kmers, curr, kmer_length, &next)==TRUE) {
+                buffer[0] = bit_encoding[(int)(next & 3)];
+                AddUnitigBases(&builder->bases, &builder->num_bases,
+                               &builder->bases_allocated, buffer, 1);
+                curr = next;
+                length++;
+            }
+
+            if (start < ReverseComplementKmer(curr, kmer_length)) {
+                AddUnitig(&builder->unitigs, &builder->num_unitigs,
+                          &builder->unitigs_allocated, zstart, length);
+            } else {
+                builder->num_bases = zstart;
+            }
+        }
+    }
+
+    Ckfree(buffer);
+    return NULL;
+}
+
+// record the position of all the kmers in the unitigs assigned to this thread
+static void* AssignKmersToUnitigs(void* arg) {
+    UnitigBuilder* builder = (UnitigBuilder*)arg;
+    SparseHashMap& kmers = *(builder->kmers);
+    const uint kmer_length = builder->kmer_length;
+
+    Kmer word, antiword, stored;
+    SparseHashMap::iterator it;
+    uint64_t indx, kindx;
+    uint32_t offset;
+
+    for (indx = builder->zstart; indx < builder->end; indx++) {
+        const char* const bases = unitig_bases + unitigs[indx].zstart;
+        kindx = KmerIndexInUnitigs(indx, 0, kmer_length);
+        word = BuildIndex(bases, kmer_length);
+
+        for (offset = 0; offset < unitigs[indx].length; offset++) {
+            word = GetNextKmer(word, bases, kmer_length, offset);
+            antiword = ReverseComplementKmer(word, kmer_length);
+            stored = word < antiword ? word : antiword;
+
+            it = kmers.find(stored);
+            ForceAssert(it != kmers.end());
+            SetKmerPosition(&(*it).second, stored == word ? kindx + offset :
+                            (kindx + offset) | REVERSED_POSITION);
+        }
+    }
+
+    return NULL;
+}
+
+// Store the edges of the first and the last kmer of the unitigs assigned to
+// this thread, along with the unitigs that are entered from them. This has to
+// be called after all the kmers have been assigned to their unitigs.
+static void* LinkUnitigs(void* arg) {
+    UnitigBuilder* builder = (UnitigBuilder*)arg;
+    SparseHashMap& kmers = *(builder->kmers);
+    const uint kmer_length = builder->kmer_length;
+
+    KmerNode node, next;
+    Kmer kmer, neighbours[4];
+    uint64_t indx;
+    uint side, base;
+
+    for (indx = builder->zstart; indx < builder->end; indx++) {
+        Unitig* const unitig = unitigs + indx;
+
+        for (side = 0; side < 2; side++) {
+            kmer = GetKmerInUnitig(unitig, side == 0 ? 0 : unitig->length - 1,
+                                   TRUE, kmer_length);
+            GetKmerNode(kmers, kmer, kmer_length, &node);
+            unitig->edges[side] = node.edges;
+            unitig->exits[side] = EXIT_UNKNOWN;
+
+            uint8_t mask = side == 0 ? Predecessors(node.edges)
+                                     : Successors(node.edges);
+            if (side == 0) {
+                RvKmers(kmer, neighbours, kmer_length);
+            } else {
+                FwKmers(kmer, neighbours, kmer_length);
+            }
+
+            for (base = 0; base < 4; base++) {
+                unitig->links[side][base] = NO_UNITIG;
+                if ((mask & (1 << base)) == 0) continue;
+
+                // the kmer entered has to be at the end of its unitig from
+                // where we continue to move in the same direction
+                GetKmerNode(kmers, neighbours[base], kmer_length, &next);
+                Bool is_decreasing = (side == 0) == next.is_forward;
+                ForceAssert(next.unitig != NO_UNITIG);
+                ForceAssert(next.offset == (is_decreasing ? 
+                            unitigs[next.unitig].length - 1 : 0));
+
+                unitig->links[side][base] = next.unitig;
+                if (next.is_forward == FALSE) {
+                    unitig->links[side][base] |= REVERSED_IN_UNITIG;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// run the function on num_threads threads, each with its own builder
+static void RunUnitigBuilders(void* (*func)(void*),
+                              UnitigBuilder* const builders,
+                              const uint num_threads) {
+    pthread_t* threads = (pthread_t*)CkallocOrDie(num_threads*sizeof(pthread_t));
+    uint indx;
+
+    for (indx = 0; indx < num_threads; indx++) {
+        if (pthread_create(&threads[indx], NULL, func, &builders[indx]) != 0) {
+            PrintThenDie("Error in creating a thread");
+        }
+    }
+    for (indx = 0; indx < num_threads; indx++) {
+        pthread_join(threads[indx], NULL);
+    }
+
+    Ckfree(threads);
+}
+
+// Compact the solid kmers into unitigs, and store the position of every kmer
+// in the unitigs along with its count. This has to be called after the edges have
+// been computed.
+static void BuildUnitigs(SparseHashMap& kmers, 
+                         const uint kmer_length,
+                         const uint num_threads) {
+    SparseHashMap::iterator it;
+    uint64_t num_keys = 0;
+    uint64_t indx;
+    uint thread;
+
+    Kmer* keys = (Kmer*)CkallocOrDie(kmers.size() * sizeof(Kmer));
+    for (it = kmers.begin(); it != kmers.end(); it++) {
+        keys[num_keys++] = (*it).first;
+        SetKmerPosition(&(*it).second, NO_POSITION);
+    }
+
+    UnitigBuilder* builders = 
+        (UnitigBuilder*)CkalloczOrDie(num_threads * sizeof(UnitigBuilder));
+    for (thread = 0; thread < num_threads; thread++) {
+        builders[thread].kmers = &kmers;
+        builders[thread].kmer_length = kmer_length;
+        builders[thread].keys = keys;
+        builders[thread].zstart = num_keys * thread / num_threads;
+        builders[thread].end = num_keys * (thread + 1) / num_threads;
+    }
+    RunUnitigBuilders(FindUnitigs, builders, num_threads);
+
+    // collect the unitigs from all the threads in order, so that the unitigs
+    // are numbered the same way irrespective of the number of threads
+    for (thread = 0; thread < num_threads; thread++) {
+        UnitigBuilder* builder = &builders[thread];
+        uint64_t zstart = num_unitig_bases;
+
+        AddUnitigBases(&unitig_bases, &num_unitig_bases, 
+                       &unitig_bases_allocated, 
+                       builder->bases, builder->num_bases);
+        for (indx = 0; indx < builder->num_unitigs; indx++) {
+            AddUnitig(&unitigs, &num_unitigs, &unitigs_allocated,
+                      zstart + builder->unitigs[indx].zstart,
+                      builder->unitigs[indx].length);
+        }
+        if (builder->bases) Ckfree(builder->bases);
+        if (builder->unitigs) Ckfree(builder->unitigs);
+    }
+
+    for (thread = 0; thread < num_threads; thread++) {
+        builders[thread].zstart = (uint64_t)num_unitigs * thread / num_threads;
+        builders[thread].end = (uint64_t)num_unitigs * (thread+1) / num_threads;
+    }
+    RunUnitigBuilders(AssignKmersToUnitigs, builders, num_threads);
+
+    // the kmers that are still unassigned are on cycles without a start. 
+    char* buffer = (char*)CkalloczOrDie(kmer_length + 1);
+    Kmer curr, next;
+    uint64_t num_cycles = 0;
+    for (indx = 0; indx < num_keys; indx++) {
+        if (GetKmerPosition(&kmers.find(keys[indx])->second) != NO_POSITION) {
+            continue;
+        }
+
+        uint64_t zstart = num_unitig_bases;
+        uint32_t length = 1;
+        ConvertKmerToString(keys[indx], kmer_length, &buffer);
+        AddUnitigBases(&unitig_bases, &num_unitig_bases, 
+                       &unitig_bases_allocated, buffer, kmer_length);
+
+        curr = keys[indx];
+        while ((HasUnitigSuccessor(kmers, curr, kmer_length, &next) == TRUE) &&
+               (next != keys[indx])) {
+            buffer[0] = bit_encoding[(int)(next & 3)];
+            AddUnitigBases(&unitig_bases, &num_unitig_bases,
+                           &unitig_bases_allocated, buffer, 1);
+            curr = next;
+            length++;
+        }
+        AddUnitig(&unitigs, &num_unitigs, &unitigs_allocated, zstart, length);
+
+        UnitigBuilder builder;
+        builder.kmers = &kmers;
+        builder.kmer_length = kmer_length;
+        builder.zstart = num_unitigs - 1;
+        builder.end = num_unitigs;
+        AssignKmersToUnitigs(&builder);
+        num_cycles++;
+    }
+    Ckfree(buffer);
+    Ckfree(keys);
+
+    // every solid kmer should be in exactly one unitig
+    ForceAssert(num_unitig_bases - (uint64_t)num_unitigs * (kmer_length - 1) ==
+                kmers.size());
+
+    // connect the ends of the unitigs
+    for (thread = 0; thread < num_threads; thread++) {
+        builders[thread].zstart = (uint64_t)num_unitigs * thread / num_threads;
+        builders[thread].end = (uint64_t)num_unitigs * (thread+1) / num_threads;
+    }
+    RunUnitigBuilders(LinkUnitigs, builders, num_threads);
+    Ckfree(builders);
+
+    PrintDebugMessage("Built %u unitigs (%"PRIu64" cycles) from %zu kmers.", 
+    num_unitigs, num_cycles, kmers.size());
+}
+
+// The number of steps we can take along the unitig of the node when extending
+// backwards (forwards) before we reach the end of the unitig. Walking backward
+// on a kmer that is read as is in the unitig takes us towards the start of the
+// unitig, and so on.
+static uint32_t StepsToUnitigEnd(const KmerNode* const node,
+                                 const Bool is_backward) {
+    if (is_backward == node->is_forward) return node->offset;
+    return unitigs[node->unitig].length - 1 - node->offset;
+}
+
+// return the edge mask of a kmer at an end of its unitig
+static uint8_t GetUnitigEndEdges(const KmerNode* const node) {
+    const Unitig* const unitig = unitigs + node->unitig;
+    uint8_t edges = unitig->edges[node->offset == 0 ? 0 : 1];
+
+    if (node->is_forward == TRUE) return edges;
+    return nibble_reverse[Successors(edges)] | 
+          (nibble_reverse[Predecessors(edges)] << 4);
+}
+
+// Return the link to the unitig entered when the node is extended backward
+// (forward) with the base, both in the orientation of the node. The node has to
+// be at the end of its unitig. REVERSED_IN_UNITIG is set in the link if the
+// kmer entered is read reverse complemented in its unitig.
+static uint32_t GetUnitigLink(const KmerNode* const node,
+                              const uint base,
+                              const Bool is_backward) {
+    Bool is_decreasing = is_backward == node->is_forward;
+    const Unitig* const unitig = unitigs + node->unitig;
+    uint32_t link = unitig->links[is_decreasing ? 0 : 1]
+                                 [node->is_forward ? base : 3 - base];
+    ForceAssert(link != NO_UNITIG);
+
+    if (node->is_forward == FALSE) link ^= REVERSED_IN_UNITIG;
+    return link;
+}
+
+// fill in the node for the kmer where an extension enters a unitig. That is the
+// first kmer of the unitig if we move along the unitig, and the last one if
+// we move against it.
+static void EnterUnitig(const uint32_t link,
+                        const Bool is_backward,
+                        KmerNode* const node) {
+    node->unitig = link & ~REVERSED_IN_UNITIG;
+    node->is_forward = (link & REVERSED_IN_UNITIG) == 0;
+    node->offset = 0;
+    if (is_backward == node->is_forward) {
+        node->offset = unitigs[node->unitig].length - 1;
+    }
+    node->edges = GetUnitigEndEdges(node);
+}
+
+// fill in the node for the neighbour of the kmer with this node. We only need
+// the hash if the kmer is not solid, otherwise we follow the unitig links.
+static void GetNeighbourNode(SparseHashMap& kmers,
+                             const Kmer neighbour,
+                             const KmerNode* const node,
+                             const uint base,
+                             const Bool is_backward,
+                             const uint kmer_length,
+                             KmerNode* const next) {
+    if (node->unitig == NO_UNITIG) {
+        GetKmerNode(kmers, neighbour, kmer_length, next);
+        return;
+    }
+    EnterUnitig(GetUnitigLink(node, base, is_backward), is_backward, next);
+}
+
+// Follow the kmer backward (forward) for at most num_steps steps, as long as
+// there is only a single choice at every step. The kmer reached after step i is
+// stored in path[i] (path[0] is the kmer), and the number of steps taken is
+// returned.
+static uint TraceUnbranchedPath(SparseHashMap& kmers,
+                                const Kmer kmer,
+                                const KmerNode* const start,
+                                const uint num_steps,
+                                const Bool is_backward,
+                                const uint kmer_length,
+                                Kmer* const path) {
+    KmerNode node = *start;
+    KmerNode next;
+    Kmer curr = kmer;
+    Kmer neighbours[4];
+    uint numsteps = 0;
+
+    path[0] = kmer;
+    while (numsteps < num_steps) {
+        if ((node.unitig != NO_UNITIG) && 
+            (StepsToUnitigEnd(&node, is_backward) > 0)) {
+            // there is a single choice at every kmer till the end of the unitig
+            if (is_backward == node.is_forward) {
+                node.offset -= 1;
+            } else {
+                node.offset += 1;
+            }
+            curr = GetKmerInUnitig(unitigs + node.unitig, node.offset,
+                                   node.is_forward, kmer_length);
+            if (StepsToUnitigEnd(&node, is_backward) == 0) {
+                node.edges = GetUnitigEndEdges(&node);
+            }
+        } else {
+            uint8_t mask = is_backward ? Predecessors(node.edges) 
+                                       : Successors(node.edges);
+            if (__builtin_popcount(mask) != 1) break;
+
+            if (is_backward == TRUE) {
+                RvKmers(curr, neighbours, kmer_length);
+            } else {
+                FwKmers(curr, neighbours, kmer_length);
+            }
+            uint base = __builtin_ctz(mask);
+            GetNeighbourNode(kmers, neighbours[base], &node, base, is_backward, 
+                             kmer_length, &next);
+            curr = neighbours[base];
+            node = next;
+        }
+        path[++numsteps] = curr;
+    }
+
+    return numsteps;
+}
+
+// the memory used to trace the branches of a bubble, which is reused by a walk
+typedef struct BubbleScratch_st {
+    Kmer* paths[2];
+    uint allocated;
+} BubbleScratch;
+
+/*
+ * Check if the two extensions of the kmer (with this node) backward (forward)
+ * form a bubble. Both the branches are traced for kmer_length + 1 + max_indel
+ * steps without a branch, and should come together again. The two branches of
+ * a substitution polymorphism are the same after kmer_length + 1 steps, while
+ * one branch of an indel of d bases has to go d steps further than the other.
+ * The shortest shift is checked first, so with max_indel = 0 we only go through
+ * substitutions, just like we always have.
+ */
+static Bool CheckForBubble(SparseHashMap& kmers,
+                           const Kmer kmer,
+                           const KmerNode* const node,
+                           const Bool is_backward,
+                           const uint kmer_length,
+                           BubbleScratch* const scratch)
+{
+    uint num_steps = kmer_length + 1 + max_indel;
+    Kmer neighbours[4];
+    KmerNode next;
+    uint lengths[2];
+    uint base, shift, num_extensions = 0;
+
+    if (scratch->allocated < num_steps + 1) {
+        scratch->allocated = num_steps + 1;
+        for (base = 0; base < 2; base++) {
+            scratch->paths[base] = (Kmer*)CkreallocOrDie(scratch->paths[base], 
+                                   scratch->allocated * sizeof(Kmer));
+        }
+    }
+    Kmer* const path0 = scratch->paths[0];
+    Kmer* const path1 = scratch->paths[1];
+
+    uint8_t mask = is_backward ? Predecessors(node->edges) 
+                               : Successors(node->edges);
+    ForceAssert(__builtin_popcount(mask) == 2);
+
+    if (is_backward == TRUE) {
+        RvKmers(kmer, neighbours, kmer_length);
+    } else {
+        FwKmers(kmer, neighbours, kmer_length);
+    }
+
+    // extend both the candidates
+    for (base = 0; base < 4; base++) {
+        if ((mask & (1 << base)) == 0) continue;
+
+        GetNeighbourNode(kmers, neighbours[base], node, base, is_backward,
+                         kmer_length, &next);
+        lengths[num_extensions] = 
+            TraceUnbranchedPath(kmers, neighbours[base], &next, num_steps, 
+                                is_backward, kmer_length, 
+                                scratch->paths[num_extensions]);
+        if (lengths[num_extensions] < kmer_length + 1) return FALSE;
+        num_extensions++;
+    }
+
+    // and check if they lead to the same kmer 
+    for (shift = 0; shift <= max_indel; shift++) {
+        if ((lengths[0] >= kmer_length + 1 + shift) &&
+            (path0[kmer_length + 1 + shift] == path1[kmer_length + 1])) {
+            return TRUE;
+        }
+        if ((lengths[1] >= kmer_length + 1 + shift) &&
+            (path1[kmer_length + 1 + shift] == path0[kmer_length + 1])) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// a stretch of a unitig that has been used in the current extension
+typedef struct UnitigSpan_st {
+    uint32_t unitig;
+    uint32_t lo;
+    uint32_t hi;
+} UnitigSpan;
+
+// the last span of a unitig in a walk
+typedef struct UnitigSlot_st {
+    uint32_t unitig;  // NO_UNITIG if the slot is empty
+    uint32_t span;
+} UnitigSlot;
+
+// spans that are not followed by another span of the same unitig
+#define NO_SPAN 0xFFFFFFFF
+
+// The bases added by an extension, and the parts of the unitigs it used. A walk
+// is reused by a thread for all its extensions, so it only grows. The spans
+// on the same unitig are chained together, and the last span of every unitig
+// is found with a small open addressed table, so checking if a kmer has been
+// used does not depend on the length of the walk.
+typedef struct Walk_st {
+    char* bases;
+    uint num_bases;
+    uint bases_allocated;
+
+    UnitigSpan* spans;
+    uint32_t* span_links;  // the previous span on the same unitig, or NO_SPAN
+    uint num_spans;
+    uint spans_allocated;
+
+    UnitigSlot* slots;
+    uint num_slots;        // a power of 2
+    uint num_used_slots;
+
+    BubbleScratch scratch;
+} Walk;
+
+static Walk* NewWalk() {
+    Walk* walk = (Walk*)CkalloczOrDie(sizeof(Walk));
+    walk->bases_allocated = flank_chunk;
+    walk->bases = (char*)CkallocOrDie(walk->bases_allocated);
+    walk->spans_allocated = 64;
+    walk->spans = (UnitigSpan*)CkallocOrDie(walk->spans_allocated * 
+                                            sizeof(UnitigSpan));
+    walk->span_links = (uint32_t*)CkallocOrDie(walk->spans_allocated * 
+                                               sizeof(uint32_t));
+    walk->num_slots = 128;
+    walk->slots = (UnitigSlot*)CkallocOrDie(walk->num_slots * 
+                                            sizeof(UnitigSlot));
+    memset(walk->slots, 0xFF, walk->num_slots * sizeof(UnitigSlot));
+    return walk;
+}
+
+static void FreeWalk(Walk** pwalk) {
+    Walk* walk = *pwalk;
+    Ckfree(walk->bases);
+    Ckfree(walk->spans);
+    Ckfree(walk->span_links);
+    Ckfree(walk->slots);
+    if (walk->scratch.paths[0]) Ckfree(walk->scratch.paths[0]);
+    if (walk->scratch.paths[1]) Ckfree(walk->scratch.paths[1]);
+    Ckfree(walk);
+    *pwalk = NULL;
+}
+
+// empty the walk so it can be used for another extension
+static void ClearWalk(Walk* const walk) {
+    walk->num_bases = 0;
+    walk->num_spans = 0;
+    if (walk->num_used_slots > 0) {
+        memset(walk->slots, 0xFF, walk->num_slots * sizeof(UnitigSlot));
+        walk->num_used_slots = 0;
+    }
+}
+
+// return the slot of the unitig, or the empty slot where it should go
+static UnitigSlot* FindUnitigSlot(const Walk* const walk,
+                                  const uint32_t unitig) {
+    uint indx = (unitig * 2654435761U) & (walk->num_slots - 1);
+
+    while ((walk->slots[indx].unitig != unitig) &&
+           (walk->slots[indx].unitig != NO_UNITIG)) {
+        indx = (indx + 1) & (walk->num_slots - 1);
+    }
+    return walk->slots + indx;
+}
+
+// double the slots, when more than half of them are used
+static void GrowUnitigSlots(Walk* const walk) {
+    UnitigSlot* old_slots = walk->slots;
+    uint old_num_slots = walk->num_slots;
+    uint indx;
+
+    walk->num_slots *= 2;
+    walk->slots = (UnitigSlot*)CkallocOrDie(walk->num_slots * 
+                                            sizeof(UnitigSlot));
+    memset(walk->slots, 0xFF, walk->num_slots * sizeof(UnitigSlot));
+
+    for (indx = 0; indx < old_num_slots; indx++) {
+        if (old_slots[indx].unitig == NO_UNITIG) continue;
+        *FindUnitigSlot(walk, old_slots[indx].unitig) = old_slots[indx];
+    }
+    Ckfree(old_slots);
+}
+
+static void AddSpanToWalk(Walk* const walk, const KmerNode* const node) {
+    if (node->unitig == NO_UNITIG) return;
+
+    if (walk->num_spans == walk->spans_allocated) {
+        walk->spans_allocated *= 2;
+        walk->spans = (UnitigSpan*)CkreallocOrDie(walk->spans, 
+                      walk->spans_allocated * sizeof(UnitigSpan));
+        walk->span_links = (uint32_t*)CkreallocOrDie(walk->span_links, 
+                           walk->spans_allocated * sizeof(uint32_t));
+    }
+    walk->spans[walk->num_spans].unitig = node->unitig;
+    walk->spans[walk->num_spans].lo = node->offset;
+    walk->spans[walk->num_spans].hi = node->offset;
+
+    UnitigSlot* slot = FindUnitigSlot(walk, node->unitig);
+    if (slot->unitig == NO_UNITIG) {
+        slot->unitig = node->unitig;
+        walk->span_links[walk->num_spans] = NO_SPAN;
+        walk->num_used_slots++;
+    } else {
+        walk->span_links[walk->num_spans] = slot->span;
+    }
+    slot->span = walk->num_spans;
+    walk->num_spans++;
+
+    if (2 * walk->num_used_slots > walk->num_slots) GrowUnitigSlots(walk);
+}
+
+// return the last span on the unitig of the node, or NO_SPAN
+static uint32_t LastSpanOnUnitig(const Walk* const walk,
+                                 const KmerNode* const node) {
+    const UnitigSlot* slot = FindUnitigSlot(walk, node->unitig);
+    return slot->unitig == NO_UNITIG ? NO_SPAN : slot->span;
+}
+
+// has this kmer already been used in the extension?
+static Bool IsKmerInWalk(const Walk* const walk, const KmerNode* const node) {
+    uint32_t indx;
+    if (node->unitig == NO_UNITIG) return FALSE;
+
+    for (indx = LastSpanOnUnitig(walk, node); 
+         indx != NO_SPAN; 
+         indx = walk->span_links[indx]) {
+        const UnitigSpan* span = walk->spans + indx;
+        if ((span->lo <= node->offset) && (node->offset <= span->hi)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// The number of steps that can be taken from the node along its unitig before
+// we reach a kmer that has already been used by the extension. The span that
+// is being extended is the last one in the walk.
+static uint32_t StepsToKmerInWalk(const Walk* const walk,
+                                  const KmerNode* const node,
+                                  const Bool is_decreasing) {
+    uint32_t steps = UINT32_MAX;
+    uint32_t indx;
+
+    for (indx = LastSpanOnUnitig(walk, node); 
+         indx != NO_SPAN; 
+         indx = walk->span_links[indx]) {
+        if (indx + 1 == walk->num_spans) continue;
+        const UnitigSpan* span = walk->spans + indx;
+
+        if ((is_decreasing == TRUE) && (span->lo < node->offset)) {
+            steps = MIN(steps, node->offset - MIN(span->hi, node->offset-1)-1);
+        } else if ((is_decreasing == FALSE) && (span->hi > node->offset)) {
+            steps = MIN(steps, MAX(span->lo, node->offset+1)-node->offset-1);
+        }
+    }
+
+    return steps;
+}
+
+// The solid kmers used by the flanks of the contigs that were printed, with a
+// bit for every kmer. The kmers are indexed by their position in the unitigs,
+// so the kmers in a span of a unitig are next to each other.
+static uint64_t* used_kmers = NULL;
+
+// has any of the kmers in these spans been used by a contig that was printed?
+static Bool UsesPrintedKmers(const UnitigSpan* const spans,
+                             const uint num_spans,
+                             const uint kmer_length) {
+    uint64_t kindx, first;
+    uint indx;
+
+    for (indx = 0; indx < num_spans; indx++) {
+        const UnitigSpan* span = spans + indx;
+        first = KmerIndexInUnitigs(span->unitig, span->lo, kmer_length);
+        for (kindx = first; kindx <= first + span->hi - span->lo; kindx++) {
+            if ((used_kmers[kindx >> 6] >> (kindx & 63)) & 1) return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// mark the kmers in these spans as used by a contig that was printed
+static void MarkKmersAsUsed(const UnitigSpan* const spans,
+                            const uint num_spans,
+                            const uint kmer_length) {
+    uint64_t kindx, first;
+    uint indx;
+
+    for (indx = 0; indx < num_spans; indx++) {
+        const UnitigSpan* span = spans + indx;
+        first = KmerIndexInUnitigs(span->unitig, span->lo, kmer_length);
+        for (kindx = first; kindx <= first + span->hi - span->lo; kindx++) {
+            used_kmers[kindx >> 6] |= 1ULL << (kindx & 63);
+        }
+    }
+}
+
+// make sure the walk has space for these many more bases
+static void ReserveWalkBases(Walk* const walk, const uint num_bases) {
+    if (walk->num_bases + num_bases > walk->bases_allocated) {
+        walk->bases_allocated = MAX(walk->bases_allocated + flank_chunk,
+                                    walk->num_bases + num_bases);
+        walk->bases = (char*)CkreallocOrDie(walk->bases, walk->bases_allocated);
+    }
+}
+
+static void AddBaseToWalk(Walk* const walk, const char base) {
+    ReserveWalkBases(walk, 1);
+    walk->bases[walk->num_bases++] = base;
+}
+
+// Add the bases from the next steps kmers of the unitig of the node. Every
+// kmer adds its first base to a backward extension, and its last base to a
+// forward extension. The bases are copied straight from the unitig.
+static void AddUnitigBasesToWalk(Walk* const walk,
+                                 const KmerNode* const node,
+                                 const uint32_t steps,
+                                 const Bool is_backward,
+                                 const uint kmer_length) {
+    const char* const bases = unitig_bases + unitigs[node->unitig].zstart;
+    Bool is_decreasing = is_backward == node->is_forward;
+    uint32_t step;
+
+    ReserveWalkBases(walk, steps);
+    char* const added = walk->bases + walk->num_bases;
+
+    if (is_decreasing == FALSE) {
+        const char* const from = bases + node->offset + kmer_length;
+        if (node->is_forward == TRUE) {
+            memcpy(added, from, steps);
+        } else {
+            for (step = 0; step < steps; step++) {
+                added[step] = bit_encoding[3-fasta_encoding[(int)from[step]]];
+            }
+        }
+    } else {
+        const char* const from = bases + node->offset - 1;
+        if (node->is_forward == TRUE) {
+            for (step = 0; step < steps; step++) {
+                added[step] = *(from - step);
+            }
+        } else {
+            for (step = 0; step < steps; step++) {
+                added[step] = bit_encoding[3-fasta_encoding[(int)*(from-step)]];
+            }
+        }
+    }
+    walk->num_bases += steps;
+}
+
+// Decide how the kmer (with this node) is extended backward (forward). If there
+// is more than one extension possible, we still extend through the ones that
+// look like a bubble from a substitution polymorphism or a short indel.
+static uint8_t DecideExtension(SparseHashMap& kmers,
+                               const Kmer kmer,
+                               const KmerNode* const node,
+                               const Bool is_backward,
+                               const uint kmer_length,
+                               BubbleScratch* const scratch) {
+    Kmer neighbours[4];
+    uint8_t mask = is_backward ? Predecessors(node->edges) 
+                               : Successors(node->edges);
+    uint num_extensions = __builtin_popcount(mask);
+
+    if (num_extensions == 0) return EXIT_DEAD_END;
+    if (num_extensions > 2) return EXIT_BRANCHES;
+    if (num_extensions == 2) {
+        // this could be rescued if this is only a polymorphism
+        if (CheckForBubble(kmers, kmer, node, is_backward, kmer_length, 
+                           scratch) == FALSE) {
+            return EXIT_BRANCHES;
+        }
+    }
+
+    if (is_backward == TRUE) {
+        RvKmers(kmer, neighbours, kmer_length);
+    } else {
+        FwKmers(kmer, neighbours, kmer_length);
+    }
+    return EXIT_BASE | 
+           SelectExtensionBase(neighbours, mask, is_backward, kmer_length);
+}
+
+// Return the decision for extending the kmer backward (forward). The decision
+// at the end of a unitig is the same for all the extensions (the branch we
+// select for a SNP does not depend on the orientation we reach it from), so
+// we remember it with the unitig in the orientation of the unitig. The threads
+// can race to store a decision, but they all store the same value.
+static uint8_t GetExtensionDecision(SparseHashMap& kmers,
+                                    const Kmer kmer,
+                                    const KmerNode* const node,
+                                    const Bool is_backward,
+                                    const uint kmer_length,
+                                    BubbleScratch* const scratch) {
+    if (node->unitig == NO_UNITIG) {
+        return DecideExtension(kmers, kmer, node, is_backward, kmer_length,
+                               scratch);
+    }
+
+    Bool is_decreasing = is_backward == node->is_forward;
+    uint8_t* const exit = &unitigs[node->unitig].exits[is_decreasing ? 0 : 1];
+    uint8_t decision = __atomic_load_n(exit, __ATOMIC_RELAXED);
+
+    if (decision == EXIT_UNKNOWN) {
+        decision = DecideExtension(kmers, kmer, node, is_backward, kmer_length,
+                                   scratch);
+
+        // the base is stored in the orientation of the unitig
+        if ((decision & EXIT_BASE) && (node->is_forward == FALSE)) {
+            decision ^= 3;
+        }
+        __atomic_store_n(exit, decision, __ATOMIC_RELAXED);
+    }
+
+    if ((decision & EXIT_BASE) && (node->is_forward == FALSE)) {
+        decision ^= 3;
+    }
+    return decision;
+}
+
+// The state of a walk that is advanced along with other walks. Every step of
+// the walk moves over the unitig it is in, and selects the kmer that should be
+// added next. That kmer is added at the start of the next step, so that the
+// unitig it is in, and its bases, can be prefetched in the meantime.
+typedef struct WalkState_st {
+    Walk* walk;
+    Kmer seed;           // the kmer the walk started from
+    Bool is_backward;
+    Bool is_done;
+    MetricCounter stop;  // why the walk is done
+    uint num_kmers;      // the number of kmers in the walk
+    uint num_probes;     // the kmers looked up in the table
+    uint64_t end_time;   // when the walk was done, if there is a trace
+
+    Kmer curr;           // the last kmer added to the walk
+    KmerNode node;       // and its node
+
+    Bool has_next;       // TRUE if a kmer has been selected to be added next
+    Kmer next;
+    uint next_base;      
+    uint32_t next_link;  // the link to its unitig, NO_UNITIG if next_node is 
+    KmerNode next_node;  // already known
+} WalkState;
+
+// start a walk from the kmer. The bases are added to the walk in the order
+// they are found.
+static void StartWalk(SparseHashMap& kmers,
+                      WalkState* const state,
+                      Walk* const walk,
+                      const Kmer kmer,
+                      const Bool is_backward,
+                      const uint kmer_length) {
+    ClearWalk(walk);
+
+    state->walk = walk;
+    state->seed = kmer;
+    state->is_backward = is_backward;
+    state->is_done = FALSE;
+    state->num_kmers = 1;
+    state->num_probes = 1;
+    state->end_time = 0;
+    state->curr = kmer;
+    state->has_next = FALSE;
+
+    GetKmerNode(kmers, kmer, kmer_length, &state->node);
+    AddSpanToWalk(walk, &state->node);
+}
+
+// prefetch the unitig the walk is going to enter in its next step
+static void PrefetchWalkUnitig(const WalkState* const state) {
+    if ((state->has_next == FALSE) || (state->next_link == NO_UNITIG)) return;
+
+    const Unitig* const unitig = 
+        unitigs + (state->next_link & ~REVERSED_IN_UNITIG);
+    __builtin_prefetch(unitig);
+    __builtin_prefetch((const char*)(unitig + 1) - 1);
+}
+
+// Prefetch the bases of the unitig the walk is going to enter, which should
+// already have been prefetched. The step reads the bases from the end it
+// enters, and the kmer at the other end, so both ends are prefetched.
+static void PrefetchWalkBases(const WalkState* const state,
+                              const uint kmer_length) {
+    if ((state->has_next == FALSE) || (state->next_link == NO_UNITIG)) return;
+
+    const Unitig* const unitig = 
+        unitigs + (state->next_link & ~REVERSED_IN_UNITIG);
+    const char* const bases = unitig_bases + unitig->zstart;
+    __builtin_prefetch(bases);
+    __builtin_prefetch(bases + unitig->length + kmer_length - 2);
+}
+
+/*
+ * Take the next step of the extension of the kmer backward (forward). We stop
+ * when we reach a point where more than one extension is possible, or we reach
+ * a kmer that has already been used in this extension. Within a unitig there is
+ * only a single extension possible at every kmer, so we move to the end of the
+ * unitig in one go and only make a decision at the end of the unitig.
+ */
+static void StepWalk(SparseHashMap& kmers, 
+                     WalkState* const state,
+                     const uint kmer_length) {
+    Walk* const walk = state->walk;
+    KmerNode* const node = &state->node;
+    const Bool is_backward = state->is_backward;
+    Kmer neighbours[4];
+
+    // add the kmer selected in the last step
+    if (state->has_next == TRUE) {
+        KmerNode next = state->next_node;
+        if (state->next_link != NO_UNITIG) {
+            EnterUnitig(state->next_link, is_backward, &next);
+        }
+        state->has_next = FALSE;
+
+        // quit, if the extension has already been seen in this contig.
+        if (IsKmerInWalk(walk, &next) == TRUE) {
+            state->is_done = TRUE;
+            state->stop = WALK_CYCLES;
+            return;
+        }
+
+        state->curr = state->next;
+        *node = next;
+        AddBaseToWalk(walk, bit_encoding[state->next_base]);
+        AddSpanToWalk(walk, node);
+        state->num_kmers += 1;
+
+        #ifndef INFEXPAND
+        if (state->num_kmers >= flank_chunk) {
+            state->is_done = TRUE;
+            state->stop = WALK_LENGTH_LIMITS;
+            return;
+        }
+        #endif
+    }
+
+    // move to the end of the unitig
+    if (node->unitig != NO_UNITIG) {
+        Bool is_decreasing = is_backward == node->is_forward;
+        uint32_t steps = StepsToUnitigEnd(node, is_backward);
+
+        // quit, if the extension has already been seen in this contig.
+        uint32_t allowed = StepsToKmerInWalk(walk, node, is_decreasing);
+        if (allowed < steps) {
+            steps = allowed;
+            state->is_done = TRUE;
+            state->stop = WALK_CYCLES;
+        }
+
+        #ifndef INFEXPAND
+        if (state->num_kmers + steps >= flank_chunk) {
+            steps = flank_chunk - state->num_kmers;
+            state->is_done = TRUE;
+            state->stop = WALK_LENGTH_LIMITS;
+        }
+        #endif
+
+        AddUnitigBasesToWalk(walk, node, steps, is_backward, kmer_length);
+        UnitigSpan* span = walk->spans + walk->num_spans - 1;
+        if (is_decreasing == TRUE) {
+            node->offset -= steps;
+            span->lo = node->offset;
+        } else {
+            node->offset += steps;
+            span->hi = node->offset;
+        }
+        state->num_kmers += steps;
+        if (state->is_done == TRUE) return;
+
+        if (steps > 0) {
+            state->curr = GetKmerInUnitig(unitigs + node->unitig, node->offset,
+                                          node->is_forward, kmer_length);
+            node->edges = GetUnitigEndEdges(node);
+        }
+    }
+
+    // quit, if there is more than one extension possible
+    uint8_t decision = GetExtensionDecision(kmers, state->curr, node, 
+                                            is_backward, kmer_length,
+                                            &walk->scratch);
+    if ((decision & EXIT_BASE) == 0) {
+        state->is_done = TRUE;
+        state->stop = decision == EXIT_DEAD_END ? WALK_DEAD_ENDS 
+                                                : WALK_BRANCHES;
+        return;
+    }
+
+    if (is_backward == TRUE) {
+        RvKmers(state->curr, neighbours, kmer_length);
+    } else {
+        FwKmers(state->curr, neighbours, kmer_length);
+    }
+    uint base = decision & 3;
+
+    state->has_next = TRUE;
+    state->next = neighbours[base];
+    state->next_base = base;
+    state->next_link = NO_UNITIG;
+    if (node->unitig == NO_UNITIG) {
+        GetKmerNode(kmers, neighbours[base], kmer_length, &state->next_node);
+        state->num_probes++;
+    } else {
+        state->next_link = GetUnitigLink(node, base, is_backward);
+    }
+}
+
+// Advance the walks till all of them are done. Every step of a walk that
+// enters a unitig waits on the memory of the unitig, and then on its bases,
+// which can only be found once the unitig has been read. So we interleave the
+// walks: the unitig of a walk is prefetched two steps of the other walks
+// before its own step, and its bases one step before it. The steps that leave
+// a unitig through a kmer that is not solid still wait on the hash table.
+static void ExtendFromKmers(SparseHashMap& kmers,
+                            WalkState* const states,
+                            const uint num_states,
+                            const uint kmer_length) {
+    uint indx, num_active = num_states;
+    const Bool is_tracing = IsTracing();
+
+    while (num_active > 0) {
+        WalkState* previous = NULL;
+        WalkState* before = NULL;
+        for (indx = 0; indx < num_states; indx++) {
+            WalkState* const state = states + indx;
+            if (state->is_done == TRUE) continue;
+
+            PrefetchWalkUnitig(state);
+            if (previous != NULL) PrefetchWalkBases(previous, kmer_length);
+            if (before != NULL) StepWalk(kmers, before, kmer_length);
+            before = previous;
+            previous = state;
+        }
+        if (before != NULL) StepWalk(kmers, before, kmer_length);
+        if (previous != NULL) {
+            PrefetchWalkBases(previous, kmer_length);
+            StepWalk(kmers, previous, kmer_length);
+        }
+
+        num_active = 0;
+        for (indx = 0; indx < num_states; indx++) {
+            if (states[indx].is_done == FALSE) {
+                num_active++;
+            } else if ((is_tracing == TRUE) && (states[indx].end_time == 0)) {
+                states[indx].end_time = GetTraceTime();
+            }
+        }
+    }
+}
+
+/*
+ * Simple Algorithm 
+ * ----------------
+ *  rvkmers = [kmer]
+ *
+ *  curr = kmer
+ *  while True:
+ *      rev = ReverseComplement(curr)
+ *
+ *      extensions = [x for x in RvKmer(curr) if x in kmersdict]
+ *      extensions.extend([x for x in FwKmer(rev) if x in kmersdict])
+ *
+ *      # Quit if there is more than one extension possible
+ *      if len(extensions) != 1:
+ *          break
+ *
+ *      # Quit if the extension has already been seen in this contig.
+ *      rev_extension = ReverseComplement(extensions[0])
+ *      if extensions[0] in rvkmers or rev_extension in rvkmers:
+ *          break
+ *
+ *      if extensions[0] in RvKmer(curr):
+ *          curr = extensions[0]
+ *      else:
+ *          assert extensions[0] in FwKmer(rev)
+ *          curr = rev_extension
+ *  
+ *      rvkmers.append(curr)
+ *  return rvkmers
+ * 
+ * We return at most flank_chunk bases on each end of the STR. The walk is only
+ * started here, it is advanced along with other walks in ExtendFromKmers.
+ */
+static void ExtendBackward(SparseHashMap& kmers, 
+                           WalkState* const state,
+                           Walk* const walk,
+                           const char* const bases, 
+                           const uint motif_zstart, 
+                           const uint kmer_length) {
+    Kmer kmer = ConvertStringToKmer(bases+motif_zstart-kmer_length, kmer_length);
+    StartWalk(kmers, state, walk, kmer, TRUE, kmer_length);
+}
+
+// return the left flank once the backward walk is done
+static char* GetBackwardFlank(const WalkState* const state,
+                              const uint kmer_length) {
+    const Walk* const walk = state->walk;
+
+    char* lflank = (char*)CkalloczOrDie(kmer_length + walk->num_bases + 1);
+    uint indx;
+    for (indx = 0; indx < walk->num_bases; indx++) {
+        lflank[indx] = walk->bases[walk->num_bases - indx - 1];
+    }
+    char* seed = lflank + walk->num_bases;
+    ConvertKmerToString(state->seed, kmer_length, &seed);
+
+    return lflank;
+}
+
+/*   
+ * Simple Algorithm:
+ * ----------------   
+ *    fwkmers = [kmer]
+ *
+ *    curr = kmer
+ *    while True:
+ *        rev = ReverseComplement(curr)
+ *
+ *        extensions = [x for x in FwKmer(curr) if x in kmersdict]
+ *        extensions.extend([x for x in RvKmer(rev) if x in kmersdict])
+ *         
+ *        # Quit if there is more than one extension possible
+ *        if len(extensions) != 1:
+ *            break
+ *         
+ *         # Quit if the extension has already been seen in this contig.
+ *        rev_extension = ReverseComplement(extensions[0])
+ *        if extensions[0] in fwkmers or rev_extension in fwkmers:
+ *            break
+ *
+ *        if extensions[0] in FwKmer(curr):
+ *            curr = extensions[0]
+ *        else:
+ *            assert extensions[0] in RvKmer(rev)
+ *            curr = rev_extension
+ *
+ *        fwkmers.append(curr)
+ *    return fwkmers
+ *
+ * We only return at most flank_chunk base pairs on either side of the STR. The
+ * walk is only started here, it is advanced along with other walks in 
+ * ExtendFromKmers.
+ */
+static void ExtendForward(SparseHashMap& kmers, 
+                          WalkState* const state,
+                          Walk* const walk,
+                          const char* const bases, 
+                          const uint motif_end, 
+                          const uint kmer_length) {
+    Kmer kmer = ConvertStringToKmer(bases+motif_end, kmer_length);
+    StartWalk(kmers, state, walk, kmer, FALSE, kmer_length);
+}
+
+// return the right flank once the forward walk is done
+static char* GetForwardFlank(const WalkState* const state,
+                             const uint kmer_length) {
+    const Walk* const walk = state->walk;
+
+    char* rflank = (char*)CkalloczOrDie(kmer_length + walk->num_bases + 1);
+    ConvertKmerToString(state->seed, kmer_length, &rflank);
+    memcpy(rflank + kmer_length, walk->bases, walk->num_bases);
+
+    return rflank;
+}
+
+/* Calculate the percent identity between sequence1, and 
+ * a) sequence2[index:] if do_reverse == FALSE
+ * b) sequence2[:index] if do_reverse == TRUE
+ */
+static float PercentIdentity(const char* const sequence1, const char* const
+sequence2, const int index, const Bool do_reverse) {
+    int indx = 0;
+    uint matches = 0;
+    uint mismatches = 0;
+
+    if (do_reverse == FALSE) {
+        // the flanks can be long, so only find the lengths once
+        size_t num_compared = MIN(strlen(sequence2)-index, strlen(sequence1));
+        for (indx = 0; indx < num_compared; indx++) {
+            if (sequence1[indx] == sequence2[index + indx]) {
+                matches += 1;
+            } else {
+                mismatches += 1;
+            }
+        }
+    } else {
+        int indx1 = 0, indx2 = 0;
+
+        for (indx1 = strlen(sequence1)-1, indx2 = index-1;
+             (indx1 >= 0) && (indx2 >= 0);
+             indx1--, indx2--) {
+            if (sequence1[indx1] == sequence2[indx2]) {
+                matches += 1;
+            } else {
+                mismatches += 1;
+            }
+        }
+    }
+
+    float pid = (matches * 100.00) / (matches + mismatches);
+    return pid;
+}
+
+/* Print the extended contig.
+ */
+static void PrintContig(const char* const name,
+                        const char* const motif,
+                        const char* const copies,
+                        const char* const lflank, 
+                        const char* const bases, 
+                        const uint read_zstart,
+                        const uint read_end,
+                        const char* const rflank,
+                        const uint motif_zstart, 
+                        const uint motif_end,
+                        const uint kmer_length) {
+    uint indx;
+    if ((lflank == NULL) || (rflank == NULL)) return;
+
+    printf(">%s\t%s:%s:%d:%d\n", 
+           name, motif, copies, 
+           strlen(lflank) + motif_zstart - read_zstart, 
+           strlen(lflank) + motif_end - read_zstart);
+
+    if (lflank != NULL) {
+        printf("%s", lflank);
+    }
+
+    for (indx = read_zstart; indx < read_end; indx++) {
+        printf("%c", bases[indx]);
+    }
+
+    if (rflank != NULL) {
+        printf("%s", rflank);
+    }
+    printf("\n");
+}
+
+static uint FindFirstGoodKmer(SparseHashMap& kmers, 
+                              const char* const bases,
+                              const uint num_kmers,
+                              const Bool return_on_first,
+                              const uint kmer_length) {
+    uint result = 0;    
+
+    if (return_on_first == TRUE) {
+        Kmer word = BuildIndex(bases, kmer_length);
+        Kmer antiword, stored;
+        int i = 0;
+    
+        for (i = 0; i < num_kmers; i++) {
+            word = GetNextKmer(word, bases, kmer_length, i);
+            antiword = ReverseComplementKmer(word, kmer_length);
+            stored = word < antiword ? word : antiword;
+
+            if (CheckKmerInSparseHashMap(kmers, stored) == TRUE) break; 
+        }
+    
+        result += (i + kmer_length);
+    } else {
+        Kmer word = BuildIndex(bases, kmer_length);
+        Kmer antiword, stored;
+        int i = 0, j = 0;
+    
+        for (i = 0; i < num_kmers; i++) {
+            word = GetNextKmer(word, bases, kmer_length, i);
+            antiword = ReverseComplementKmer(word, kmer_length);
+            stored = word < antiword ? word : antiword;
+
+            if (CheckKmerInSparseHashMap(kmers, stored) == TRUE) j = i;
+        }
+
+        result += j;
+    }
+
+    return result;
+}
+
+static void IssueWarningAboutKmerLength(const uint kmer_length)
+{
+    fprintf(stderr, "\n==========================================================================\n");
+    fprintf(stderr, "Please note:\n");
+    fprintf(stderr, "Kmer length %u for extension is greater than the flank requirement used for \n", kmer_length);
+    fprintf(stderr, "STR discovery in select_STR_reads. This can lead to some blocks being ignored\n");
+    fprintf(stderr, "during extension.\n");
+    fprintf(stderr, "============================================================================\n\n");
+}
+
+// the number of STR reads that are extended together
+#define EXTENSION_BATCH_SIZE 10000
+
+// the number of STR reads whose walks are advanced together by a thread
+#define READS_IN_LOCKSTEP 8
+
+// the walks with at least these many kmers are shown in the trace
+#define TRACE_WALK_LENGTH 512
+
+// a merged STR read along with the result of its extension
+typedef struct ExtendedRead_st {
+    uint32_t number;     // the position of the read in the input file
+    char* name;
+    char motif[7];
+    char* copies;
+    int zstart, end;     // the location of the STR in the read
+    char* bases;
+    uint slen;
+
+    uint indx1, indx2;
+    char* lflank;
+    char* rflank;
+    Bool is_extended;    // TRUE if both the flanks look correct
+    uint num_short_ends; // ends that could not be extended because of klen
+
+    UnitigSpan* spans;   // the parts of the unitigs used by the flanks
+    uint num_spans;
+} ExtendedRead;
+
+// what the threads extending a batch of STR reads need
+typedef struct STRExtender_st {
+    SparseHashMap* kmers;
+    uint kmer_length;
+    ExtendedRead* reads;
+    uint num_reads;
+    Walk** walks;        // 2 * READS_IN_LOCKSTEP for every thread
+    WalkState* states;   // and their states
+} STRExtender;
+
+// remember the kmers used in the walk
+static void AddWalkToRead(ExtendedRead* const read, const Walk* const walk) {
+    read->spans = (UnitigSpan*)CkreallocOrDie(read->spans,
+                  (read->num_spans + walk->num_spans) * sizeof(UnitigSpan));
+    memcpy(read->spans + read->num_spans, walk->spans, 
+           walk->num_spans * sizeof(UnitigSpan));
+    read->num_spans += walk->num_spans;
+}
+
+// Add the walk, and why it stopped, to the metrics. A long walk is also added
+// to the trace, from the time the walks advanced with it were started.
+static void CountWalk(const WalkState* const state, const uint64_t start) {
+    AddToCounter(WALKS, 1);
+    AddToCounter(WALK_KMERS, state->num_kmers);
+    AddToCounter(WALK_PROBES, state->num_probes);
+    AddToCounter(state->stop, 1);
+
+    if ((state->num_kmers >= TRACE_WALK_LENGTH) && (state->end_time != 0)) {
+        TraceAsyncSpan("walk", start, state->end_time, state->num_kmers);
+    }
+}
+
+// Extend the next READS_IN_LOCKSTEP STR reads on both ends. This is called by
+// the threads in the pool. All the walks are started first, and are advanced
+// together.
+static void ExtendSTRReads(void* const arg, 
+                           const uint64_t item, 
+                           const uint thread) {
+    STRExtender* const extender = (STRExtender*)arg;
+    SparseHashMap& kmers = *(extender->kmers);
+    const uint kmer_length = extender->kmer_length;
+    Walk** const walks = extender->walks + thread * 2 * READS_IN_LOCKSTEP;
+    WalkState* const states = extender->states + thread * 2 * READS_IN_LOCKSTEP;
+
+    uint zstart = item * READS_IN_LOCKSTEP;
+    uint num_reads = MIN(READS_IN_LOCKSTEP, extender->num_reads - zstart);
+    uint indx;
+    const uint64_t start = GetTraceTime();
+
+    for (indx = 0; indx < num_reads; indx++) {
+        ExtendedRead* const read = extender->reads + zstart + indx;
+        WalkState* const lstate = states + 2 * indx;
+        WalkState* const rstate = states + 2 * indx + 1;
+
+        // lets see if we can extend this read towards the 5' end.
+        if (kmer_length > read->zstart) {
+            // this block cannot be extended on this side
+            read->indx1 = 0;
+            lstate->is_done = TRUE;
+        } else {
+            read->indx1 = FindFirstGoodKmer(kmers, 
+                                            read->bases, 
+                                            read->zstart - kmer_length + 1, 
+                                            TRUE,
+                                            kmer_length);
+            ExtendBackward(kmers, lstate, walks[2 * indx], read->bases, 
+                           read->indx1, kmer_length);
+        }
+
+        // Lets see if we can extend this reads towards the 3' end.
+        if ((read->slen - read->end) < kmer_length) {
+            read->indx2 = 0;
+        } else {
+            read->indx2 = FindFirstGoodKmer(kmers, 
+                                    read->bases + read->end, 
+                                    read->slen - read->end - kmer_length + 1, 
+                                    FALSE,
+                                    kmer_length);
+        }
+        read->indx2 += read->end;
+        ExtendForward(kmers, rstate, walks[2 * indx + 1], read->bases, 
+                      read->indx2, kmer_length);
+    }
+
+    ExtendFromKmers(kmers, states, 2 * num_reads, kmer_length);
+
+    for (indx = 0; indx < num_reads; indx++) {
+        ExtendedRead* const read = extender->reads + zstart + indx;
+        WalkState* const lstate = states + 2 * indx;
+        WalkState* const rstate = states + 2 * indx + 1;
+
+        if (kmer_length > read->zstart) {
+            read->num_short_ends++;
+        } else {
+            CountWalk(lstate, start);
+            read->lflank = GetBackwardFlank(lstate, kmer_length);
+            AddWalkToRead(read, lstate->walk);
+            
+            // does this extension look correct?
+            if ((read->lflank == NULL) || 
+                (PercentIdentity(read->lflank, read->bases, read->indx1, TRUE) 
+                < 95.00)) {
+                continue;
+            }
+        }
+
+        if ((read->slen - read->end) < kmer_length) {
+            read->num_short_ends++;
+        }
+        CountWalk(rstate, start);
+        read->rflank = GetForwardFlank(rstate, kmer_length);
+        AddWalkToRead(read, rstate->walk);
+        
+        // does this extension look correct?
+        if ((read->rflank == NULL) || 
+            (PercentIdentity(read->rflank, read->bases, read->indx2, FALSE) 
+            < 95.00)) {
+            continue;
+        }
+
+        // a contig is only printed with both the flanks
+        if (read->lflank != NULL) read->is_extended = TRUE;
+    }
+}
+
+void ExtendMergedBlocks(SparseHashMap& kmers,
+                        const uint kmer_length,
+                        const uint extension_length,
+                        const uint indel_length,
+                        const uint num_threads,
+                        NextBlockFunction next,
+                        void* const next_arg) {
+    flank_chunk = extension_length;
+    max_indel = indel_length;
+
+    // store the neighbours of every kmer along with its count
+    StartPhase(UNITIG_PHASE);
+    ComputeKmerEdges(kmers, kmer_length);
+    PrintDebugMessage("Computed the edges for %zu kmers.", kmers.size());
+
+    // compact the kmers into unitigs, so the extensions can skip over them
+    BuildUnitigs(kmers, kmer_length, num_threads);
+    EndPhase(UNITIG_PHASE);
+
+    // a kmer can only be used by the flanks of one contig
+    used_kmers = (uint64_t*)CkalloczOrDie((kmers.size() / 64 + 1) * 
+                                          sizeof(uint64_t));
+
+    AddToCounter(KMER_TABLE_BYTES, kmers.size() * 
+                 sizeof(SparseHashMap::value_type));
+    AddToCounter(UNITIG_BYTES, num_unitigs * sizeof(Unitig) + 
+                 num_unitig_bases + (kmers.size() / 64 + 1) * sizeof(uint64_t));
+
+    // every thread gets its own walks
+    STRExtender extender;
+    extender.kmers = &kmers;
+    extender.kmer_length = kmer_length;
+    extender.reads = (ExtendedRead*)CkalloczOrDie(EXTENSION_BATCH_SIZE * 
+                                                  sizeof(ExtendedRead));
+    uint num_walks = num_threads * 2 * READS_IN_LOCKSTEP;
+    extender.walks = (Walk**)CkallocOrDie(num_walks * sizeof(Walk*));
+    extender.states = (WalkState*)CkallocOrDie(num_walks * sizeof(WalkState));
+    uint windx;
+    for (windx = 0; windx < num_walks; windx++) {
+        extender.walks[windx] = NewWalk();
+    }
+
+    // traverse the reads with the STR's and try to extend them on both ends.
+    // The reads are extended in batches by the threads in the pool, and are
+    // printed in the order of the input once the batch is done. A read is only
+    // printed if none of the kmers in its flanks were used by a contig that was
+    // printed before it, which is decided in the order of the input, so the
+    // contigs are the ones we get when the reads are extended one at a time.
+    StartPhase(EXTENSION_PHASE);
+    const MergedBlock* block = next(next_arg);
+
+    uint32_t num_reads = 0;
+    uint indx, num_batch;
+    Bool extensionWarningSet = FALSE;
+    uint64_t numNotExtended = 0;
+
+    while (block) {
+        // read the next batch of STR reads
+        for (num_batch = 0; 
+             (block != NULL) && (num_batch < EXTENSION_BATCH_SIZE); 
+             num_batch++) {
+            ExtendedRead* read = extender.reads + num_batch;
+
+            read->number = num_reads++;
+            read->name = CopyString(block->name);
+            memcpy(read->motif, block->motif, sizeof(read->motif));
+            read->copies = CopyString(block->copies);
+            read->zstart = block->zstart;
+            read->end = block->end;
+            // the seed for the forward extension can run past the end of a
+            // read that is too short on that side, so pad it with kmer_length
+            // empty bases
+            read->bases = (char*)CkalloczOrDie(block->slen + kmer_length + 1);
+            memcpy(read->bases, block->bases, block->slen);
+            read->slen = block->slen;
+
+            block = next(next_arg);
+        }
+
+        extender.num_reads = num_batch;
+        const uint64_t start = GetTraceTime();
+        RunWorkStealingPool((num_batch + READS_IN_LOCKSTEP - 1) / 
+                            READS_IN_LOCKSTEP, 
+                            num_threads, ExtendSTRReads, &extender);
+        TraceSpan("extension_batch", start, NULL, num_batch);
+
+        for (indx = 0; indx < num_batch; indx++) {
+            ExtendedRead* read = extender.reads + indx;
+            if (debug_flag) {
+                PrintDebugMessage("------------ %s ------------", read->name);
+            }
+
+            if ((kmer_length > read->zstart) && (extensionWarningSet == FALSE)){
+                IssueWarningAboutKmerLength(kmer_length);
+                extensionWarningSet = TRUE;
+            }
+            numNotExtended += read->num_short_ends;
+
+            // print this contig after the extension.
+            if ((read->is_extended == TRUE) &&
+                (UsesPrintedKmers(read->spans, read->num_spans, 
+                                  kmer_length) == FALSE)) {
+                MarkKmersAsUsed(read->spans, read->num_spans, kmer_length);
+                PrintContig(read->name, read->motif, read->copies, 
+                            read->lflank, 
+                            read->bases, read->indx1, read->indx2, 
+                            read->rflank,
+                            read->zstart, read->end, kmer_length);
+                AddToCounter(CONTIGS, 1);
+            }
+
+            Ckfree(read->name);
+            Ckfree(read->copies);
+            Ckfree(read->bases);
+            if (read->lflank) Ckfree(read->lflank);
+            if (read->rflank) Ckfree(read->rflank);
+            if (read->spans) Ckfree(read->spans);
+            memset(read, 0, sizeof(ExtendedRead));
+        }
+    }
+
+
+    EndPhase(EXTENSION_PHASE);
+
+    for (windx = 0; windx < num_walks; windx++) {
+        FreeWalk(&extender.walks[windx]);
+    }
+    Ckfree(extender.walks);
+    Ckfree(extender.states);
+    Ckfree(extender.reads);
+    Ckfree(used_kmers);
+
+    if (extensionWarningSet == TRUE) {
+        fprintf(stderr, "\n==========================================================================\n");
+        fprintf(stderr, "%"PRIu64" ends of merged reads were not extended as the kmer length for extension \n", numNotExtended);
+        fprintf(stderr, "is greater than the flank requirement used for STR discovery in select_STR_reads\n");
+        fprintf(stderr, "\n==========================================================================\n");
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef STR_EXTENDER_H_
+#define STR_EXTENDER_H_
+
+extern "C" {
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include <inttypes.h>
+
+#include "utilities.h"
+#include "merged_block.h"
+#include "metrics.h"
+}
+
+#include "sparse_kmer_hash.h"
+
+// Return the next block to be extended, or NULL at the end. The block only
+// has to stay valid until the next call.
+typedef const MergedBlock* (*NextBlockFunction)(void* const arg);
+
+// Extend the blocks from next on both ends with the kmers that are seen more
+// than once in the reads, and print the contigs in fasta format. The edges of
+// the kmers and the unitigs are built first, so the kmers should already be
+// counted. An extension stops after extension_length bases, and goes through
+// bubbles from indels of up to indel_length bases. The blocks are extended in
+// batches with num_threads threads, and are printed in the order of next. A
+// block is only printed if none of the kmers in its flanks were used by an
+// earlier block.
+void ExtendMergedBlocks(SparseHashMap& kmers,
+                        const uint kmer_length,
+                        const uint extension_length,
+                        const uint indel_length,
+                        const uint num_threads,
+                        NextBlockFunction next,
+                        void* const next_arg);
+
+#endif  // STR_EXTENDER_H_
@@ -0,0 +1,1848 @@
+#include "str_merger.h"
+
+#include <errno.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+extern "C" {
+#include "kmer.h"
+#include "thread_pool.h"
+#include "arena.h"
+#include "sllist.h"
+#include "trace.h"
+}
+
+#include "sparse_word_hash.h"
+
+extern Bool debug_flag;
+
+// A percent identity threshold. 
+const double pid_threshold = 90.0;
+
+// The maximum number of gaps allowed in the alignment of a flank. 
+const uint max_gaps = 2;
+
+// A flank packed with 2 bits per base, starting at the base next to the STR.
+typedef struct PackedFlank_st {
+    uint64_t* words;
+    uint length;
+    uint allocated;
+} PackedFlank;
+
+// The scores and the traceback of the cells of an alignment. Only the cells
+// within max_gaps of the diagonal where the flanks should line up are used, so
+// the buffer is linear in the length of the flanks, and is reused for all the
+// alignments. The flanks of the read and of a block are packed here for the
+// filter that runs before the alignment, and the aligned flanks are kept here
+// until they are copied into the consensus of the block.
+typedef struct AlignBuffer_st {
+    int* scores;
+    uchar* trace;
+    size_t allocated;
+    PackedFlank flanks[4];
+    char* lseq;
+    char* lqual;
+    char* rseq;
+    char* rqual;
+    size_t consensus_allocated;
+} AlignBuffer;
+
+// How many candidate blocks were ruled out by the filter, and how many of the
+// ones that passed the filter did not align.
+typedef struct FilterStats_st {
+    uint64_t num_candidates;
+    uint64_t num_filtered;
+    uint64_t num_unaligned;
+} FilterStats;
+
+#define BAND_WIDTH (2 * max_gaps + 1)
+
+// The number of blocks that a read is scored against at once, one per lane of
+// a vector of 16-bit integers.
+#define ALIGN_LANES 8
+typedef int16_t AlignLanes 
+    __attribute__ ((vector_size (ALIGN_LANES * sizeof(int16_t))));
+
+// The cells of one row of the band for all the lanes. Along with the score of
+// a cell we carry the number of matches, mismatches and gaps on the path that
+// the traceback in Align follows from that cell, and the diagonal where that 
+// traceback stops.
+typedef struct BandRow_st {
+    AlignLanes scores[BAND_WIDTH];
+    AlignLanes matches[BAND_WIDTH];
+    AlignLanes mismatches[BAND_WIDTH];
+    AlignLanes gaps[BAND_WIDTH];
+    AlignLanes starts[BAND_WIDTH];
+} BandRow;
+
+static void Reverse(char* const seq, const uint len)
+{
+    char* s = seq;
+    char* p = seq + len - 1;
+    
+    while (s <= p) {
+        uchar c;
+        c = *s;
+        *s = *p;
+        *p = c;
+        ++s; --p;
+    }
+}
+
+// Return the index of the cell (i,j) in the band around the diagonal where
+// i - j == diagonal, or -1 if the cell is outside the band.
+static inline int BandIndex(const int i, const int j, const int diagonal) {
+    int k = j - (i - diagonal) + max_gaps;
+    if ((k < 0) || (k >= BAND_WIDTH)) return -1;
+    return i * BAND_WIDTH + k;
+}
+
+// the score of a cell, where the cells outside the band are treated as 0. A
+// gap from such a cell is always worse than starting a new local alignment.
+static inline int BandScore(const AlignBuffer* const buffer,
+                            const int i, const int j, const int diagonal) {
+    if ((i == 0) || (j == 0)) return 0;
+    int indx = BandIndex(i, j, diagonal);
+    return indx < 0 ? 0 : buffer->scores[indx];
+}
+
+// Align the two sequences, and calculate the consensus sequence. Both the left
+// flanks end at the STR, so they should line up on the diagonal through their
+// last bases, while both the right flanks start at the STR and should line up
+// on the diagonal through their first bases. Any alignment that is more than
+// max_gaps away from that diagonal is rejected by AlignFlanks, so only the
+// cells in that band are aligned.
+static void Align(const char* const seq1, const char* const qual1, 
+                  const uint zstart1, const uint end1,
+                  const char* const seq2, const char* const qual2,
+                  const uint zstart2, const uint end2,
+                  uint* gaps, float* pid, char** pseq, char** pqual, 
+                  const uint slen, const Bool is_right_gapped,
+                  AlignBuffer* const buffer)
+{
+    char* seq = *pseq;
+    char* qual = *pqual;
+
+    uint len1 = end1 - zstart1 + 1;
+    uint len2 = end2 - zstart2 + 1;
+
+    const char* t1 = seq1 + zstart1;
+    const char* q1 = qual1 + zstart1;
+    const char* t2 = seq2 + zstart2;
+    const char* q2 = qual2 + zstart2;
+
+    // counters in loops
+    int i, j;
+
+    // initialize the scores
+    int match    = 1;
+    int mismatch = -1;
+    int gap  = -3;
+
+    int diagonal = is_right_gapped ? 0 : (int)len1 - (int)len2;
+
+    if (buffer->allocated < len1 * BAND_WIDTH) {
+        buffer->allocated = len1 * BAND_WIDTH;
+        buffer->scores = (int*)CkreallocOrDie(buffer->scores, 
+                                              buffer->allocated * sizeof(int));
+        buffer->trace = (uchar*)CkreallocOrDie(buffer->trace, 
+                                               buffer->allocated);
+    }
+    memset(buffer->scores, 0, len1 * BAND_WIDTH * sizeof(int));
+    memset(buffer->trace, 0, len1 * BAND_WIDTH);
+
+    int best = 0, optlox = 0, optloy = 0;
+    int score, score1, score2, score3;
+
+    for (i = 1; i < len1; i++) {
+        int jstart = MAX(1, i - diagonal - (int)max_gaps);
+        int jend = MIN((int)len2 - 1, i - diagonal + (int)max_gaps);
+
+        for (j = jstart; j <= jend; j++) {
+            int indx = BandIndex(i, j, diagonal);
+
+            score1 = BandScore(buffer, i, j-1, diagonal) + gap;
+
+            score2 = BandScore(buffer, i-1, j, diagonal) + gap;
+
+            if (t1[i-1] == t2[j-1]) {
+                score3 = BandScore(buffer, i-1, j-1, diagonal) + match;
+            } else {
+                score3 = BandScore(buffer, i-1, j-1, diagonal) + mismatch;
+            }
+
+            score = MAX(MAX(score1,score2),MAX(score3,0));
+            buffer->scores[indx] = score;
+
+            if (score == score3) {
+                buffer->trace[indx] = 0;
+            } else if (score == score2) {
+                buffer->trace[indx] = 1;
+            } else if (score == score1) {
+                buffer->trace[indx] = 2;
+            }
+    
+            if (score >= best) {
+                best = score;
+                optlox = i;
+                optloy = j;
+            }
+        }
+    }
+
+    // without any similarity the last cell of the full matrix is the best one
+    if ((best == 0) && (len1 > 1) && (len2 > 1)) {
+        optlox = len1 - 1;
+        optloy = len2 - 1;
+    }
+
+    // trace backwards to find the best location 
+    int matches = 0, mismatches = 0;
+    int num_gaps = 0;
+
+    i = optlox;
+    j = optloy;
+    int max_score = best;
+    int sindx = 0;
+
+    if (is_right_gapped) {
+        uint a = 0;
+        if (len1 > len2) {
+            int a = len1-1;
+            while (a > j) {
+                seq[sindx] = t1[a-1];
+                qual[sindx++] = q1[a-1];
+                a--;
+            }
+        } else {
+            int a = len2-1;
+            while (a > j) {
+                seq[sindx] = t2[a-1];
+                qual[sindx++] = q2[a-1];
+                a--;
+            }
+        }
+    } else {
+        num_gaps = len2 - optloy - 1;
+    }
+
+    while ((max_score > 0) && (i >= 1) && (j >= 1)) {
+        uchar trace = buffer->trace[BandIndex(i, j, diagonal)];
+        if (trace == 0) {
+            if (q1[i-1] > q2[j-1]) {
+                seq[sindx] = t1[i-1];
+                qual[sindx] = q1[i-1];
+            } else {
+                seq[sindx] = t2[j-1];
+                qual[sindx] = q2[j-1];
+            }
+            sindx++;
+            if (t1[i-1] != t2[j-1]) {
+                mismatches++;
+            } else {
+                matches++;
+            }
+            i--; j--;
+        } else if (trace == 1) {
+            if (q1[i-1] > '5') {
+                seq[sindx] = t1[i-1];
+                qual[sindx++] = q1[i-1];
+            }
+            i--;
+            num_gaps++;
+        } else if (trace == 2) {
+            if (q2[j-1] > '5') {
+                seq[sindx] = t2[j-1];
+                qual[sindx++] = q2[j-1];
+            }
+            j--;
+            num_gaps++;
+        }
+        
+        max_score = BandScore(buffer, i, j, diagonal);
+    }
+
+    if (is_right_gapped) {
+        num_gaps = MAX(i,j) - MIN(i,j);
+    } else {
+        uint a = 0;
+        if (len1 > len2) {
+            int a = i;
+            while (a > 0) {
+                seq[sindx] = t1[a-1];
+                qual[sindx++] = q1[a-1];
+                a--;
+            }
+        } else {
+            int a = j;
+            while (a > 0) {
+                seq[sindx] = t2[a-1];
+                qual[sindx++] = q2[a-1];
+                a--;
+            }
+        }
+    }
+
+    Reverse(seq, sindx);
+    Reverse(qual, sindx);
+    seq[sindx] = 0;
+    qual[sindx] = 0;
+
+    *gaps = num_gaps;
+    *pid = matches * 100.0 / (matches + mismatches);
+}
+
+// blocks get room for these many more bases than they need, so the consensus
+// can usually grow in place
+#define BLOCK_SLACK 32
+
+// make sure the block has room for a sequence of length slen
+static void ReserveBlockSequence(Block* const block,
+                                 const uint slen,
+                                 Arena* const arena)
+{
+    if (slen + 1 <= block->allocated) return;
+
+    block->allocated = slen + 1 + BLOCK_SLACK;
+    block->seq = (char*)ArenaAllocOrDie(arena, 2 * block->allocated);
+    block->qual = block->seq + block->allocated;
+}
+
+// add a read with these many copies of the motif to the block
+static void AddCopiesToBlock(Block* const block,
+                             const int copies,
+                             Arena* const arena)
+{
+    uint indx;
+    for (indx = 0; indx < block->num_supports; indx++) {
+        if (block->supports[indx].copies == copies) {
+            block->supports[indx].nsupport += 1;
+            return;
+        }
+    }
+
+    if (block->num_supports == block->allocated_supports) {
+        Copies* supports = (Copies*)ArenaAllocOrDie(arena, 
+                           2 * block->allocated_supports * sizeof(Copies));
+        memcpy(supports, block->supports, 
+               block->num_supports * sizeof(Copies));
+        block->supports = supports;
+        block->allocated_supports *= 2;
+    }
+    block->supports[block->num_supports].copies = copies;
+    block->supports[block->num_supports].nsupport = 1;
+    block->num_supports++;
+}
+
+// create a block with a single read
+static Block* NewBlock(const FastqSequence* const seq,
+                       const int copies,
+                       const int zstart,
+                       const int end,
+                       Arena* const arena)
+{
+    Block* const block = (Block*)ArenaAllocOrDie(arena, sizeof(Block));
+    block->next = NULL;
+    block->zstart = zstart;
+    block->end = end;
+    block->slen = seq->slen;
+    block->support = 1;
+    block->num_supports = 0;
+    block->allocated_supports = INLINE_COPIES;
+    block->supports = block->inline_supports;
+    block->allocated = 0;
+
+    ReserveBlockSequence(block, seq->slen, arena);
+    memcpy(block->seq, seq->bases, seq->slen);
+    memcpy(block->qual, seq->quals, seq->slen);
+    block->seq[seq->slen] = '\0';
+    block->qual[seq->slen] = '\0';
+
+    AddCopiesToBlock(block, copies, arena);
+    return block;
+}
+
+static Bool AlignFlanks(Block* const block,
+                        const FastqSequence* const seq,
+                        const char* const motif,
+                        const int copies,
+                        const int zstart,
+                        const int end,
+                        const uint max_threshold,
+                        AlignBuffer* const buffer,
+                        Arena* const arena)
+{
+    float pid;    
+    uint gaps = 0;
+    AddToCounter(ALIGNMENTS, 1);
+    
+    uint slen = MAX(block->slen,seq->slen);
+    if (buffer->consensus_allocated < slen + 1) {
+        buffer->consensus_allocated = slen + 1;
+        buffer->lseq = (char*)CkreallocOrDie(buffer->lseq, slen + 1);
+        buffer->lqual = (char*)CkreallocOrDie(buffer->lqual, slen + 1);
+        buffer->rseq = (char*)CkreallocOrDie(buffer->rseq, slen + 1);
+        buffer->rqual = (char*)CkreallocOrDie(buffer->rqual, slen + 1);
+    }
+    
+    // Align the sequences to the left of the STR
+    Align(block->seq, block->qual, 0, block->zstart, 
+    seq->bases, seq->quals, 0, zstart, &gaps, &pid, 
+    &buffer->lseq, &buffer->lqual, slen, FALSE, buffer);
+
+    if ((pid < pid_threshold) || (gaps > max_gaps)) {
+        if (debug_flag) {
+            PrintDebugMessage(
+            "Low pid (%2.2f) or too many gaps (%d) for the left flank.", 
+            pid, gaps);
+        }
+        return FALSE;
+    }
+
+    // Align the sequences to the right of the STR
+    Align(block->seq, block->qual, block->end, block->slen, 
+    seq->bases, seq->quals, end, seq->slen, &gaps, &pid,
+    &buffer->rseq, &buffer->rqual, slen, TRUE, buffer);
+
+    if ((pid < pid_threshold) || (gaps > max_gaps)) {
+        if (debug_flag) {
+            PrintDebugMessage(
+            "Low pid (%2.2f) or too many gaps (%d) for the right flank.",
+            pid, gaps);
+        }
+        return FALSE;
+    }
+
+    // If I am here then these this block and this read seem like they support
+    // the same STR. Lets combine them to create a new block. Both the flanks 
+    // have been aligned, so the consensus can be written over the old 
+    // sequence of the block.
+    block->support++;
+    AddCopiesToBlock(block, copies, arena);
+
+    uint mlen = strlen(motif);
+    uint rlen = strlen(buffer->rseq);
+    block->zstart = strlen(buffer->lseq);
+    block->end = block->zstart + mlen;
+    block->slen = block->end + rlen;
+    ReserveBlockSequence(block, block->slen, arena);
+
+    memcpy(block->seq, buffer->lseq, block->zstart);
+    memcpy(block->seq + block->zstart, motif, mlen);
+    memcpy(block->seq + block->end, buffer->rseq, rlen);
+    block->seq[block->slen] = '\0';
+    memcpy(block->qual, buffer->lqual, block->zstart);
+    memset(block->qual + block->zstart, '!', mlen);
+    memcpy(block->qual + block->end, buffer->rqual, rlen);
+    block->qual[block->slen] = '\0';
+
+    return TRUE;
+}
+
+// Score the flank t2 of a read against the flanks t1s of up to ALIGN_LANES
+// blocks at once, without a traceback. The gaps and the percent identity for
+// every lane are the ones that Align reports for that pair of flanks, so the
+// flanks that fail the thresholds never have to be aligned.
+static void ScoreFlanksInLanes(const char* const* const t1s,
+                               const int* const len1s,
+                               const uint num_lanes,
+                               const char* const t2,
+                               const int len2,
+                               const Bool is_right_gapped,
+                               uint* const gaps,
+                               float* const pids)
+{
+    const int16_t match    = 1;
+    const int16_t mismatch = -1;
+    const int16_t gap      = -3;
+
+    int16_t diagonals[ALIGN_LANES];
+    int max_len1 = 0;
+    uint l;
+    int i, k;
+
+    for (l = 0; l < ALIGN_LANES; l++) {
+        int len1 = l < num_lanes ? len1s[l] : 0;
+        diagonals[l] = is_right_gapped ? 0 : len1 - len2;
+        max_len1 = MAX(max_len1, len1);
+    }
+    AlignLanes diagonal;
+    memcpy(&diagonal, diagonals, sizeof(AlignLanes));
+
+    // a cell that the traceback does not go past, at band position k of a row
+    AlignLanes zero = diagonal - diagonal;
+    AlignLanes one = zero + 1;
+    #define STOP_AT(k) (diagonal + (int16_t)(max_gaps - (k)))
+
+    BandRow rows[2];
+    BandRow* prev = rows;
+    BandRow* curr = rows + 1;
+    for (k = 0; k < BAND_WIDTH; k++) {
+        prev->scores[k] = prev->matches[k] = zero;
+        prev->mismatches[k] = prev->gaps[k] = zero;
+        prev->starts[k] = STOP_AT(k);
+    }
+
+    AlignLanes best = zero, best_matches = zero, best_mismatches = zero;
+    AlignLanes best_gaps = zero, best_starts = zero, best_j = zero;
+
+    int16_t valids[ALIGN_LANES], substs[ALIGN_LANES], js[ALIGN_LANES];
+    for (i = 1; i < max_len1; i++) {
+        for (k = 0; k < BAND_WIDTH; k++) {
+            for (l = 0; l < ALIGN_LANES; l++) {
+                int j = i - diagonals[l] - (int)max_gaps + k;
+                js[l] = j;
+                valids[l] = (l < num_lanes) && (i < len1s[l]) && 
+                            (j >= 1) && (j < len2) ? -1 : 0;
+                substs[l] = valids[l] && (t1s[l][i-1] == t2[j-1]) ? 
+                            match : mismatch;
+            }
+            AlignLanes valid, subst, j;
+            memcpy(&valid, valids, sizeof(AlignLanes));
+            memcpy(&subst, substs, sizeof(AlignLanes));
+            memcpy(&j, js, sizeof(AlignLanes));
+
+            // the cells to the left, above, and along the diagonal
+            AlignLanes score1 = (k > 0 ? curr->scores[k-1] : zero) + gap;
+            AlignLanes score2 = 
+                (k < BAND_WIDTH - 1 ? prev->scores[k+1] : zero) + gap;
+            AlignLanes score3 = prev->scores[k] + subst;
+
+            AlignLanes score = score1 > score2 ? score1 : score2;
+            score = score3 > score ? score3 : score;
+            score = score > zero ? score : zero;
+            score = valid ? score : zero;
+
+            AlignLanes is_diagonal = score == score3;
+            AlignLanes is_up = ~is_diagonal & (score == score2);
+            AlignLanes extends = score > zero;
+
+            AlignLanes matches, mismatches, gaps, starts;
+            if (k > 0) {
+                matches = curr->matches[k-1];
+                mismatches = curr->mismatches[k-1];
+                gaps = curr->gaps[k-1] + one;
+                starts = curr->starts[k-1];
+            } else {
+                matches = mismatches = gaps = zero;
+                starts = STOP_AT(k-1);
+            }
+            if (k < BAND_WIDTH - 1) {
+                matches = is_up ? prev->matches[k+1] : matches;
+                mismatches = is_up ? prev->mismatches[k+1] : mismatches;
+                gaps = is_up ? prev->gaps[k+1] + one : gaps;
+                starts = is_up ? prev->starts[k+1] : starts;
+            } else {
+                matches = is_up ? zero : matches;
+                mismatches = is_up ? zero : mismatches;
+                gaps = is_up ? one : gaps;
+                starts = is_up ? STOP_AT(k+1) : starts;
+            }
+            matches = is_diagonal ? 
+                      prev->matches[k] + (subst == match ? one : zero) : matches;
+            mismatches = is_diagonal ? 
+                      prev->mismatches[k] + (subst == match ? zero : one) : 
+                      mismatches;
+            gaps = is_diagonal ? prev->gaps[k] : gaps;
+            starts = is_diagonal ? prev->starts[k] : starts;
+
+            curr->scores[k] = score;
+            curr->matches[k] = extends ? matches : zero;
+            curr->mismatches[k] = extends ? mismatches : zero;
+            curr->gaps[k] = extends ? gaps : zero;
+            curr->starts[k] = extends ? starts : STOP_AT(k);
+
+            // the cells are visited in the same order as in Align
+            AlignLanes is_best = valid & (score >= best);
+            best = is_best ? score : best;
+            best_matches = is_best ? curr->matches[k] : best_matches;
+            best_mismatches = is_best ? curr->mismatches[k] : best_mismatches;
+            best_gaps = is_best ? curr->gaps[k] : best_gaps;
+            best_starts = is_best ? curr->starts[k] : best_starts;
+            best_j = is_best ? j : best_j;
+        }
+
+        BandRow* tmp = prev;
+        prev = curr;
+        curr = tmp;
+    }
+    #undef STOP_AT
+
+    for (l = 0; l < num_lanes; l++) {
+        int num_matches = best_matches[l];
+        int num_mismatches = best_mismatches[l];
+        int num_gaps = best_gaps[l];
+        int start = best_starts[l];
+        int optlox = 0, optloy = best_j[l];
+
+        // without any similarity Align picks the last cell of the matrix
+        if (best[l] == 0) {
+            num_matches = num_mismatches = num_gaps = 0;
+            optloy = 0;
+            if ((len1s[l] > 1) && (len2 > 1)) {
+                optlox = len1s[l] - 1;
+                optloy = len2 - 1;
+            }
+            start = optlox - optloy;
+        }
+
+        if (is_right_gapped) {
+            gaps[l] = abs(start);
+        } else {
+            gaps[l] = len2 - optloy - 1 + num_gaps;
+        }
+        pids[l] = num_matches * 100.0 / (num_matches + num_mismatches);
+    }
+}
+
+// Pack length bases of the flank, walking away from the STR in steps of step
+// from the base at bases.
+static void PackFlank(const char* const bases,
+                      const int length,
+                      const int step,
+                      PackedFlank* const flank)
+{
+    // an extra word lets us read 32 bases starting anywhere in the flank
+    uint num_words = length / 32 + 2;
+    if (flank->allocated < num_words) {
+        flank->allocated = num_words;
+        flank->words = (uint64_t*)CkreallocOrDie(flank->words, 
+                                                 num_words * sizeof(uint64_t));
+    }
+    memset(flank->words, 0, num_words * sizeof(uint64_t));
+    flank->length = length;
+
+    int i;
+    for (i = 0; i < length; i++) {
+        uint64_t base = fasta_encoding[(int)bases[i * step]] & 0x3;
+        flank->words[i / 32] |= base << (2 * (i % 32));
+    }
+}
+
+// return the 32 bases of the flank starting at offset
+static inline uint64_t PackedBasesAt(const PackedFlank* const flank,
+                                     const uint offset)
+{
+    uint indx = offset / 32;
+    uint shift = 2 * (offset % 32);
+    if (shift == 0) return flank->words[indx];
+    return (flank->words[indx] >> shift) | 
+           (flank->words[indx + 1] << (64 - shift));
+}
+
+// Return the number of bases in the first flank that do not match the second
+// flank for any shift of up to max_gaps bases. Every mismatch and every gap in
+// an alignment of the flanks within the band accounts for at most one of these
+// bases, so this is a lower bound on the edits in such an alignment.
+static uint CountUnmatchedBases(const PackedFlank* const flank1,
+                                const PackedFlank* const flank2)
+{
+    const uint64_t low_bits = 0x5555555555555555ULL;
+    int length = (int)MIN(flank1->length, flank2->length) - 2 * (int)max_gaps;
+    uint unmatched = 0;
+    int offset, shift;
+
+    for (offset = 0; offset < length; offset += 32) {
+        uint64_t bases = PackedBasesAt(flank1, offset + max_gaps);
+        uint64_t mismatches = low_bits;
+        for (shift = 0; shift < BAND_WIDTH; shift++) {
+            uint64_t diff = bases ^ PackedBasesAt(flank2, offset + shift);
+            mismatches &= (diff | (diff >> 1)) & low_bits;
+        }
+        if (length - offset < 32) {
+            mismatches &= low_bits >> (2 * (32 - (length - offset)));
+        }
+        unmatched += __builtin_popcountll(mismatches);
+    }
+
+    return unmatched;
+}
+
+// Return FALSE if the flank is too different for an alignment of its overlap
+// with the flank of the read to stay within the thresholds on the percent 
+// identity and the gaps.
+static Bool PassesFlankFilter(const PackedFlank* const flank,
+                              const PackedFlank* const read_flank)
+{
+    uint length = MIN(flank->length, read_flank->length);
+    uint allowed = (uint)(length * (100.0 - pid_threshold) / 100.0) + max_gaps;
+    return CountUnmatchedBases(flank, read_flank) <= allowed ? TRUE : FALSE;
+}
+
+// Merge the read into the first block in the list that it aligns to. The
+// blocks are scored in groups of ALIGN_LANES, and only the candidates that
+// pass the thresholds for both the flanks are aligned to build the consensus.
+// If stats is not NULL, the blocks whose flanks are clearly different from the
+// ones of the read are filtered out first.
+static Bool MergeIntoBlocks(Block* const blocks,
+                            const FastqSequence* const seq,
+                            const char* const motif,
+                            const int copies,
+                            const int zstart,
+                            const int end,
+                            const uint max_threshold,
+                            AlignBuffer* const buffer,
+                            Arena* const arena,
+                            FilterStats* const stats)
+{
+    Block* candidates[ALIGN_LANES];
+    const char* t1s[ALIGN_LANES];
+    int len1s[ALIGN_LANES];
+    uint gaps[ALIGN_LANES];
+    float pids[ALIGN_LANES];
+    uint num_candidates, l, n;
+
+    PackedFlank* const read_flanks = buffer->flanks;
+    PackedFlank* const block_flanks = buffer->flanks + 2;
+    if (stats) {
+        PackFlank(seq->bases + zstart - 1, zstart, -1, read_flanks);
+        PackFlank(seq->bases + end, seq->slen - end, 1, read_flanks + 1);
+    }
+
+    Block* iter = blocks;
+    while (iter) {
+        for (num_candidates = 0; 
+             iter && (num_candidates < ALIGN_LANES); 
+             iter = iter->next) {
+            if (stats) {
+                stats->num_candidates++;
+                PackFlank(iter->seq + iter->zstart - 1, iter->zstart, -1, 
+                          block_flanks);
+                PackFlank(iter->seq + iter->end, iter->slen - iter->end, 1,
+                          block_flanks + 1);
+                if ((PassesFlankFilter(block_flanks, read_flanks) == FALSE) ||
+                    (PassesFlankFilter(block_flanks + 1, 
+                                       read_flanks + 1) == FALSE)) {
+                    stats->num_filtered++;
+                    continue;
+                }
+            }
+            candidates[num_candidates++] = iter;
+        }
+
+        // there is nothing to gain for a single block, or when the scores
+        // might not fit in the lanes
+        Bool use_lanes = (num_candidates > 1) && (seq->slen < INT16_MAX);
+        for (l = 0; l < num_candidates; l++) {
+            if (candidates[l]->slen >= INT16_MAX) use_lanes = FALSE;
+        }
+        if (use_lanes == FALSE) {
+            for (l = 0; l < num_candidates; l++) {
+                if (AlignFlanks(candidates[l], seq, motif, copies, zstart, end,
+                                max_threshold, buffer, arena) == TRUE) {
+                    return TRUE;
+                }
+                if (stats) stats->num_unaligned++;
+            }
+            continue;
+        }
+
+        // the flanks to the left of the STR
+        for (l = 0; l < num_candidates; l++) {
+            t1s[l] = candidates[l]->seq;
+            len1s[l] = candidates[l]->zstart + 1;
+        }
+        ScoreFlanksInLanes(t1s, len1s, num_candidates, seq->bases, zstart + 1, 
+                           FALSE, gaps, pids);
+        for (n = 0, l = 0; l < num_candidates; l++) {
+            if ((pids[l] < pid_threshold) || (gaps[l] > max_gaps)) {
+                if (stats) stats->num_unaligned++;
+                continue;
+            }
+            candidates[n++] = candidates[l];
+        }
+        if (n == 0) continue;
+        num_candidates = n;
+
+        // and the ones to the right of the STR, for the blocks that are left
+        for (l = 0; l < num_candidates; l++) {
+            t1s[l] = candidates[l]->seq + candidates[l]->end;
+            len1s[l] = candidates[l]->slen - candidates[l]->end + 1;
+        }
+        ScoreFlanksInLanes(t1s, len1s, num_candidates, seq->bases + end, 
+                           seq->slen - end + 1, TRUE, gaps, pids);
+        for (l = 0; l < num_candidates; l++) {
+            if ((pids[l] < pid_threshold) || (gaps[l] > max_gaps) ||
+                (AlignFlanks(candidates[l], seq, motif, copies, zstart, end,
+                             max_threshold, buffer, arena) == FALSE)) {
+                if (stats) stats->num_unaligned++;
+                continue;
+            }
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// the number of STR reads that are merged together
+#define MERGE_BATCH_SIZE 10000
+
+// The blocks are split into these many partitions by their key, so the reads
+// in different partitions can be merged at the same time.
+#define NUM_PARTITIONS 4096
+
+// the keys with at least these many reads are shown in the trace
+#define TRACE_GROUP_SIZE 64
+
+// an STR read along with the fields in its name, on the strand of its key
+typedef struct STRRead_st {
+    uint64_t number;           // the position of the read in the input file
+    FastqSequence sequence;    // the name, bases, and quals of the read
+    BlockKey key;
+    char motif[7];
+    int copies, zstart, end;
+    uint partition;
+} STRRead;
+
+// the read that added a key to the blocks of a partition
+typedef struct KeyOrigin_st {
+    uint64_t number;
+    BlockKey key;
+    uint partition;
+} KeyOrigin;
+
+// the keys added to a partition, in the order they were added
+typedef struct KeyList_st {
+    KeyOrigin* keys;
+    uint64_t num_keys;
+    uint64_t allocated;
+} KeyList;
+
+// what the threads merging a batch of STR reads need
+typedef struct STRMerger_st {
+    uint klength;
+    uint max_threshold;
+    Bool use_filter;
+    STRRead* reads;
+    uint num_reads;
+    uint* order;                         // the reads sorted by partition
+    uint* offsets;                       // where every partition starts
+    uint* partitions;                    // the partitions with reads
+    uint num_partitions;
+    SparseBlockHashMap* blocks;          // the blocks for every partition
+    KeyList* keys;                       // and the keys in them
+    AlignBuffer* buffers;                // one for every thread
+    Arena* arenas;                       // one for every thread
+    FilterStats* stats;                  // one for every thread
+} STRMerger;
+
+// Write the motif of the repeat on the reverse complement of the bases, which
+// is read off the forward strand.
+static void GetReverseMotif(const FastqSequence* const sequence,
+                            const TandemRepeat* const rc_repeat,
+                            char* const motif)
+{
+    uint indx;
+    for (indx = 0; indx < rc_repeat->period; indx++) {
+        const char base = 
+            sequence->bases[sequence->slen - rc_repeat->zstart - indx - 1];
+        motif[indx] = bit_encoding[3 - (fasta_encoding[(int)base] & 3)];
+    }
+    motif[rc_repeat->period] = '\0';
+}
+
+// write the scanned read with the STR on either strand in its name, the way
+// scan_STR_reads prints it
+static void WriteSelectedRead(FILE* const fp,
+                              const FastqSequence* const sequence,
+                              const TandemRepeat* const repeat,
+                              const TandemRepeat* const rc_repeat)
+{
+    char rmotif[7];
+    GetReverseMotif(sequence, rc_repeat, rmotif);
+    fprintf(fp, "%s\t%.*s\t%u\t%u\t%u\t%s\t%u\t%u\t%u\n", sequence->name,
+            repeat->period, sequence->bases + repeat->zstart,
+            repeat->copies, repeat->zstart, repeat->end,
+            rmotif, rc_repeat->copies, rc_repeat->zstart, rc_repeat->end);
+    fprintf(fp, "%s\n+\n%s\n", sequence->bases, sequence->quals);
+}
+
+// Move to the next read in the binary file of STR reads, or close it at the
+// end.
+static void AdvanceRecords(STRReadSource* const source)
+{
+    if (ReadSTRReadRecord(source->records, &source->record, &source->repeat,
+                          &source->rc_repeat) == TRUE) {
+        source->sequence = &source->record;
+        return;
+    }
+    CloseRecordReader(&source->records);
+    if (source->record.name) Ckfree(source->record.name);
+    if (source->record.bases) Ckfree(source->record.bases);
+    if (source->record.quals) Ckfree(source->record.quals);
+    memset(&source->record, 0, sizeof(FastqSequence));
+    source->sequence = NULL;
+}
+
+void AdvanceSTRReadSource(STRReadSource* const source)
+{
+    while (TRUE) {
+        if (source->records != NULL) {
+            AdvanceRecords(source);
+        } else if (source->sequence != NULL) {
+            source->sequence = GetNextSequence(source->sequence);
+        } else if (source->findex < source->num_files) {
+            const char* const fqname = source->fqnames[source->findex++];
+            if (source->scanner == NULL) {
+                source->records = OpenRecordReader(fqname, STR_READ_RECORDS);
+            }
+            if (source->records != NULL) {
+                AdvanceRecords(source);
+            } else {
+                source->sequence = 
+                    ReadFastqSequence(fqname, source->illumina_quals, FALSE);
+            }
+        } else {
+            return;
+        }
+
+        if (source->sequence == NULL) continue;
+        if (source->visit) source->visit(source->visit_arg, source->sequence);
+        if (source->scanner == NULL) return;
+
+        FastqSequence* const sequence = source->sequence;
+        source->num_scanned++;
+        if (NormalizeBases(sequence->bases, sequence->slen) == FALSE) {
+            PrintMessageThenDie("read %s should only have ACGTN",
+                                sequence->name + 1);
+        }
+        if (FindBestTandemRepeats(source->scanner, sequence->bases, 
+                                  sequence->slen, &source->repeat, 
+                                  &source->rc_repeat) == TRUE) {
+            if (source->selected) {
+                WriteSelectedRead(source->selected, sequence, &source->repeat,
+                                  &source->rc_repeat);
+            }
+            return;
+        }
+    }
+}
+
+void OpenSTRReadSource(STRReadSource* const source,
+                       char** const fqnames,
+                       const uint num_files,
+                       const Bool illumina_quals,
+                       const STRScanner* const scanner,
+                       FILE* const selected,
+                       ReadVisitor visit,
+                       void* const visit_arg)
+{
+    memset(source, 0, sizeof(STRReadSource));
+    source->fqnames = fqnames;
+    source->num_files = num_files;
+    source->illumina_quals = illumina_quals;
+    source->scanner = scanner;
+    source->selected = selected;
+    source->visit = visit;
+    source->visit_arg = visit_arg;
+    AdvanceSTRReadSource(source);
+}
+
+// Build the key for the STR with this motif at [zstart, end) in the bases.
+static void BuildBlockKey(BlockKey* const key,
+                          const char* const bases,
+                          const char* const motif,
+                          const int zstart,
+                          const int end,
+                          const uint klength)
+{
+    key->lflank = ConvertStringToKmer(bases + (zstart - klength), klength);
+    key->rflank = ConvertStringToKmer(bases + end, klength);
+    key->motif = 0;
+    key->motif_length = strlen(motif);
+    for (uint indx = 0; indx < key->motif_length; indx++) {
+        key->motif = (key->motif << 2) | (fasta_encoding[(int)motif[indx]] & 3);
+    }
+}
+
+// order the keys by their flanks and then by their motif
+static int CompareBlockKeys(const BlockKey* const k1, const BlockKey* const k2)
+{
+    if (k1->lflank != k2->lflank) return k1->lflank < k2->lflank ? -1 : 1;
+    if (k1->rflank != k2->rflank) return k1->rflank < k2->rflank ? -1 : 1;
+    if (k1->motif_length != k2->motif_length) {
+        return k1->motif_length < k2->motif_length ? -1 : 1;
+    }
+    if (k1->motif != k2->motif) return k1->motif < k2->motif ? -1 : 1;
+    return 0;
+}
+
+// write the motif in the key into the buffer
+static void GetMotifInKey(const BlockKey* const key, char* const motif)
+{
+    for (uint indx = 0; indx < key->motif_length; indx++) {
+        uint shift = 2 * (key->motif_length - indx - 1);
+        motif[indx] = bit_encoding[(key->motif >> shift) & 3];
+    }
+    motif[key->motif_length] = '\0';
+}
+
+// copy length characters from str into the buffer, growing it if needed
+static void CopyIntoBuffer(char** const buffer,
+                           size_t* const allocated,
+                           const char* const str,
+                           const size_t length)
+{
+    if (*allocated < length + 1) {
+        *allocated = length + 1;
+        *buffer = (char*)CkreallocOrDie(*buffer, *allocated);
+    }
+    memcpy(*buffer, str, length);
+    (*buffer)[length] = '\0';
+}
+
+// Copy the next read in the source into the STR read, on the strand with the 
+// smaller key. The STR on either strand is parsed from the name of the read, 
+// or is the one that the scanner found or that was read from a binary file.
+static void PrepareSTRRead(STRRead* const read,
+                           STRReadSource* const source,
+                           const uint64_t number,
+                           const uint klength)
+{
+    FastqSequence* const sequence = source->sequence;
+    char name[1024];
+    char fmotif[7], rmotif[7];
+    int fcopies, fzstart, fend, rcopies, rzstart, rend;
+    BlockKey fkey, rkey;
+
+    if ((source->scanner == NULL) && (source->sequence != &source->record)) {
+        // parse the name of the read.
+        if (sscanf(sequence->name,
+                   "%[^\t]\t%s\t%d\t%d\t%d\t%s\t%d\t%d\t%d\n",
+                   name, fmotif, &fcopies, &fzstart, &fend, 
+                   rmotif, &rcopies, &rzstart, &rend) != 9) {
+            PrintMessageThenDie("Error in parsing read name %s",
+                                sequence->name);
+        }
+    } else {
+        const TandemRepeat* const frepeat = &source->repeat;
+        const TandemRepeat* const rrepeat = &source->rc_repeat;
+
+        memcpy(fmotif, sequence->bases + frepeat->zstart, frepeat->period);
+        fmotif[frepeat->period] = '\0';
+        GetReverseMotif(sequence, rrepeat, rmotif);
+
+        fcopies = frepeat->copies;
+        fzstart = frepeat->zstart;
+        fend = frepeat->end;
+        rcopies = rrepeat->copies;
+        rzstart = rrepeat->zstart;
+        rend = rrepeat->end;
+    }
+    read->number = number;
+
+    // use the strand with the smaller key
+    BuildBlockKey(&fkey, sequence->bases, fmotif, fzstart, fend, klength);
+    ReverseComplementSequence(sequence);
+    BuildBlockKey(&rkey, sequence->bases, rmotif, rzstart, rend, klength);
+    if (CompareBlockKeys(&fkey, &rkey) < 0) {
+        ReverseComplementSequence(sequence);
+        read->key = fkey;
+        memcpy(read->motif, fmotif, sizeof(fmotif));
+        read->copies = fcopies;
+        read->zstart = fzstart;
+        read->end = fend;
+    } else {
+        read->key = rkey;
+        memcpy(read->motif, rmotif, sizeof(rmotif));
+        read->copies = rcopies;
+        read->zstart = rzstart;
+        read->end = rend;
+    }
+
+    FastqSequence* const copy = &read->sequence;
+    CopyIntoBuffer(&copy->name, &copy->name_length, 
+                   sequence->name, strlen(sequence->name));
+    CopyIntoBuffer(&copy->bases, &copy->bases_length, 
+                   sequence->bases, sequence->slen);
+    CopyIntoBuffer(&copy->quals, &copy->quals_length, 
+                   sequence->quals, sequence->slen);
+    copy->slen = sequence->slen;
+}
+
+// Merge the read into a block with the same key, or start a new block with
+// the read.
+static void MergeRead(const STRMerger* const merger,
+                      STRRead* const read,
+                      AlignBuffer* const align_buffer,
+                      Arena* const arena,
+                      FilterStats* const filter_stats)
+{
+    SparseBlockHashMap& blocks = merger->blocks[read->partition];
+    KeyList* const keys = merger->keys + read->partition;
+    FastqSequence* const sequence = &read->sequence;
+
+    if (debug_flag == TRUE) {
+        char lflank[64], rflank[64];
+        char* plflank = lflank;
+        char* prflank = rflank;
+        ConvertKmerToString(read->key.lflank, merger->klength, &plflank);
+        ConvertKmerToString(read->key.rflank, merger->klength, &prflank);
+        lflank[merger->klength] = rflank[merger->klength] = '\0';
+        PrintDebugMessage("Processing %s", sequence->name + 1);
+        fprintf(stderr, "%s %s %s\n", read->motif, lflank, rflank);
+    }
+
+    // Check if the sequence aligns to some reads that we have already
+    // processed
+    Bool merged_block = FALSE;
+    Bool in_hash = CheckInSparseBlockHashMap(blocks, read->key);
+
+    if (in_hash == TRUE) {
+        merged_block = MergeIntoBlocks(blocks[read->key], sequence, read->motif,
+                                       read->copies, read->zstart, read->end,
+                                       merger->max_threshold, align_buffer,
+                                       arena, filter_stats);
+    }
+
+    if (merged_block == FALSE) {
+        Block* block = NewBlock(sequence, read->copies, read->zstart, 
+                                read->end, arena);
+
+        if (in_hash == TRUE) {
+            SllAddHead(&blocks[read->key], block); 
+        } else {
+            blocks[read->key] = block;
+
+            if (keys->num_keys == keys->allocated) {
+                keys->allocated = keys->allocated ? 2 * keys->allocated : 1024;
+                keys->keys = (KeyOrigin*)CkreallocOrDie(keys->keys,
+                             keys->allocated * sizeof(KeyOrigin));
+            }
+            keys->keys[keys->num_keys].number = read->number;
+            keys->keys[keys->num_keys].key = read->key;
+            keys->keys[keys->num_keys].partition = read->partition;
+            keys->num_keys++;
+        }
+    }
+
+    if (debug_flag) 
+        fprintf(stderr, "-----------------------------------------------\n");
+}
+
+// Merge the reads of a partition in the batch, in the order of the input. This
+// is called by the threads in the pool, which get whole partitions, so a key
+// with many reads is merged by one thread without waiting on the others.
+static void MergeReadsInPartition(void* const arg,
+                                  const uint64_t item,
+                                  const uint thread)
+{
+    STRMerger* const merger = (STRMerger*)arg;
+    const uint partition = merger->partitions[item];
+
+    for (uint indx = merger->offsets[partition]; 
+         indx < merger->offsets[partition + 1]; indx++) {
+        MergeRead(merger, merger->reads + merger->order[indx], 
+                  merger->buffers + thread, merger->arenas + thread,
+                  merger->use_filter ? merger->stats + thread : NULL);
+    }
+}
+
+// order the keys by the reads that added them
+static int CompareKeyOrigins(const void* a, const void* b)
+{
+    const KeyOrigin* const k1 = (const KeyOrigin*)a;
+    const KeyOrigin* const k2 = (const KeyOrigin*)b;
+    if (k1->number < k2->number) return -1;
+    if (k1->number > k2->number) return 1;
+    return 0;
+}
+
+// the longest name and list of copy numbers of a merged block
+#define BLOCK_FIELD_LENGTH 32
+
+// Pass the blocks in the list that pass the thresholds to visit, numbering
+// them from bindex. The same merged block is filled in for every one of them.
+static void VisitBlocks(const Block* const block,
+                        const char* const fmotif,
+                        const uint min_threshold,
+                        const uint max_threshold,
+                        const Bool include_all,
+                        uint* const bindex,
+                        MergedBlock* const merged,
+                        BlockVisitor visit,
+                        void* const visit_arg)
+{
+    const uint motif_length = strlen(fmotif);
+    if (merged->name == NULL) {
+        merged->name = (char*)CkallocOrDie(BLOCK_FIELD_LENGTH);
+        merged->name_allocated = BLOCK_FIELD_LENGTH;
+        merged->copies = (char*)CkallocOrDie(BLOCK_FIELD_LENGTH);
+        merged->copies_allocated = BLOCK_FIELD_LENGTH;
+    }
+
+    for (const Block* iter = block; iter; iter = iter->next) {
+        int i=0;
+        int maxcopies = 0;
+        uint16_t copies[3];
+        copies[0] = copies[1] = copies[2] = 0;
+        uint16_t nsupport[3];
+        nsupport[0] = nsupport[1] = nsupport[2] = 0;
+        // the copy numbers that were seen last come first
+        for (int c = iter->num_supports - 1; c >= 0; c--) {
+            const Copies* const tmp = iter->supports + c;
+            if (tmp->nsupport >= 2) {
+                copies[i] = tmp->copies;
+                if (copies[i] > maxcopies) maxcopies = copies[i];
+                nsupport[i] = tmp->nsupport;
+                i++;
+            }
+            if (i == 3) break;
+        }
+
+        if ((iter->support >= min_threshold) && 
+            (iter->support <= max_threshold)) {
+            if ((!include_all && (copies[2] == 0) && (copies[1] != 0)) ||
+                ( include_all && (copies[2] == 0))) {
+                sprintf(merged->name, "Block%u", (*bindex)++);
+                strcpy(merged->motif, fmotif);
+                if (include_all && copies[1] == 0) {
+                    sprintf(merged->copies, "%d", copies[0]);
+                } else {
+                    sprintf(merged->copies, "%d,%d", copies[0], copies[1]);
+                }
+
+                // the STR is replaced by the most copies of the motif, with
+                // the lowest quality
+                ForceAssert(iter->end == (iter->zstart + motif_length));
+                const uint str_length = maxcopies * motif_length;
+                const uint rlength = iter->slen - iter->end;
+                merged->zstart = iter->zstart;
+                merged->end = iter->zstart + str_length;
+                merged->slen = merged->end + rlength;
+                ReserveMergedBlock(merged, merged->slen);
+
+                memcpy(merged->bases, iter->seq, iter->zstart);
+                memcpy(merged->quals, iter->qual, iter->zstart);
+                for (int j = 0; j < maxcopies; j++) {
+                    memcpy(merged->bases + iter->zstart + j * motif_length,
+                           fmotif, motif_length);
+                }
+                memset(merged->quals + iter->zstart, '!', str_length);
+                memcpy(merged->bases + merged->end, iter->seq + iter->end, 
+                       rlength);
+                memcpy(merged->quals + merged->end, iter->qual + iter->end, 
+                       rlength);
+                merged->bases[merged->slen] = '\0';
+                merged->quals[merged->slen] = '\0';
+
+                visit(visit_arg, merged);
+                AddToCounter(MERGED_BLOCKS, 1);
+            }
+        }
+    }
+}
+
+// print how many of the candidate blocks were ruled out by the filter
+static void ReportFilterStats(const FilterStats* const stats,
+                              const uint num_stats)
+{
+    FilterStats filter_stats;
+    memset(&filter_stats, 0, sizeof(FilterStats));
+    for (uint indx = 0; indx < num_stats; indx++) {
+        filter_stats.num_candidates += stats[indx].num_candidates;
+        filter_stats.num_filtered += stats[indx].num_filtered;
+        filter_stats.num_unaligned += stats[indx].num_unaligned;
+    }
+    PrintDebugMessage("The filter ruled out %"PRIu64" of %"PRIu64" "
+                      "candidate blocks, and %"PRIu64" of the rest did not "
+                      "align.", filter_stats.num_filtered, 
+                      filter_stats.num_candidates, 
+                      filter_stats.num_unaligned);
+}
+
+void MergeShortTandemRepeatReads(const uint klength, 
+                                 STRReadSource* const source,
+                                 const uint progress_chunk,
+                                 const uint min_threshold,
+                                 const uint max_threshold,
+                                 const Bool include_all,
+                                 const Bool use_filter,
+                                 const uint num_threads,
+                                 BlockVisitor visit,
+                                 void* const visit_arg)
+{
+    uint64_t num_sequence_processed = 0;
+    uint indx;
+    StartPhase(MERGE_PHASE);
+
+    // every partition gets its own blocks, and every thread its own buffers
+    STRMerger merger;
+    memset(&merger, 0, sizeof(STRMerger));
+    merger.klength = klength;
+    merger.max_threshold = max_threshold;
+    merger.use_filter = use_filter;
+    merger.reads = 
+        (STRRead*)CkalloczOrDie(MERGE_BATCH_SIZE * sizeof(STRRead));
+    merger.order = (uint*)CkallocOrDie(MERGE_BATCH_SIZE * sizeof(uint));
+    merger.offsets = (uint*)CkallocOrDie((NUM_PARTITIONS + 1) * sizeof(uint));
+    merger.partitions = (uint*)CkallocOrDie(NUM_PARTITIONS * sizeof(uint));
+    merger.blocks = new SparseBlockHashMap[NUM_PARTITIONS];
+    merger.keys = (KeyList*)CkalloczOrDie(NUM_PARTITIONS * sizeof(KeyList));
+    merger.buffers = 
+        (AlignBuffer*)CkalloczOrDie(num_threads * sizeof(AlignBuffer));
+    merger.stats = 
+        (FilterStats*)CkalloczOrDie(num_threads * sizeof(FilterStats));
+    merger.arenas = (Arena*)CkallocOrDie(num_threads * sizeof(Arena));
+    for (indx = 0; indx < num_threads; indx++) {
+        InitArena(merger.arenas + indx, ARENA_CHUNK_SIZE);
+    }
+
+    // The reads are read in batches. Every read is looked up with the smaller
+    // of the keys for its two strands, so the reads of an STR from either 
+    // strand share a key. The partitions with reads in the batch are handed
+    // to the threads in the pool, and every partition merges its reads in the
+    // order of the input, so the blocks are the same as the ones we get when
+    // the reads are merged one after the other.
+    char fmotif[7];
+    uint num_batch;
+
+    while (source->sequence) {
+        const uint64_t start = GetTraceTime();
+
+        for (num_batch = 0; 
+             (source->sequence != NULL) && (num_batch < MERGE_BATCH_SIZE); 
+             num_batch++) {
+            STRRead* const read = merger.reads + num_batch;
+
+            // print progress
+            num_sequence_processed += 1;
+            if ((debug_flag == FALSE) &&
+                ((num_sequence_processed - 1) % progress_chunk == 0)) {
+                PrintDebugMessage("Processing read number %"PRIu64": %s",
+                num_sequence_processed, source->sequence->name + 1);
+            }
+
+            PrepareSTRRead(read, source, num_sequence_processed, klength);
+            read->partition = 
+                BlockKeyHasher()(read->key) % NUM_PARTITIONS;
+
+            AdvanceSTRReadSource(source);
+        }
+        TraceSpan("read_batch", start, NULL, num_batch);
+
+        // sort the reads by their partition, keeping them in the input order
+        memset(merger.offsets, 0, (NUM_PARTITIONS + 1) * sizeof(uint));
+        for (indx = 0; indx < num_batch; indx++) {
+            merger.offsets[merger.reads[indx].partition + 1]++;
+        }
+        merger.num_partitions = 0;
+        for (indx = 0; indx < NUM_PARTITIONS; indx++) {
+            if (merger.offsets[indx + 1] > 0) {
+                merger.partitions[merger.num_partitions++] = indx;
+            }
+            merger.offsets[indx + 1] += merger.offsets[indx];
+        }
+        for (indx = 0; indx < num_batch; indx++) {
+            merger.order[merger.offsets[merger.reads[indx].partition]++] = indx;
+        }
+        for (indx = NUM_PARTITIONS; indx > 0; indx--) {
+            merger.offsets[indx] = merger.offsets[indx - 1];
+        }
+        merger.offsets[0] = 0;
+
+        merger.num_reads = num_batch;
+        StartPhase(ALIGNMENT_PHASE);
+        RunWorkStealingPool(merger.num_partitions, num_threads, 
+                            MergeReadsInPartition, &merger);
+        EndPhase(ALIGNMENT_PHASE);
+    }
+    PrintDebugMessage("Processed %"PRIu64" reads.", num_sequence_processed);
+    if (source->scanner != NULL) {
+        PrintDebugMessage("Scanned %"PRIu64" reads.", source->num_scanned);
+    }
+    AddToCounter(MERGED_READS, num_sequence_processed);
+    AddToCounter(SCANNED_READS, source->num_scanned);
+
+    if (use_filter == TRUE) {
+        ReportFilterStats(merger.stats, num_threads);
+    }
+
+    for (indx = 0; indx < MERGE_BATCH_SIZE; indx++) {
+        FastqSequence* const copy = &merger.reads[indx].sequence;
+        if (copy->name) Ckfree(copy->name);
+        if (copy->bases) Ckfree(copy->bases);
+        if (copy->quals) Ckfree(copy->quals);
+    }
+    Ckfree(merger.reads);
+    Ckfree(merger.order);
+    Ckfree(merger.offsets);
+    Ckfree(merger.partitions);
+    for (indx = 0; indx < num_threads; indx++) {
+        AlignBuffer* const align_buffer = merger.buffers + indx;
+        if (align_buffer->scores) Ckfree(align_buffer->scores);
+        if (align_buffer->trace) Ckfree(align_buffer->trace);
+        for (int i = 0; i < 4; i++) {
+            if (align_buffer->flanks[i].words) {
+                Ckfree(align_buffer->flanks[i].words);
+            }
+        }
+        if (align_buffer->lseq) Ckfree(align_buffer->lseq);
+        if (align_buffer->lqual) Ckfree(align_buffer->lqual);
+        if (align_buffer->rseq) Ckfree(align_buffer->rseq);
+        if (align_buffer->rqual) Ckfree(align_buffer->rqual);
+    }
+    Ckfree(merger.buffers);
+    Ckfree(merger.stats);
+
+    // Gather the blocks from all the partitions. The keys are added in the 
+    // order of the reads that first used them, which is the order they would
+    // have been added in if all the reads were merged one after the other. So
+    // the blocks are printed in the same order irrespective of the number of
+    // threads.
+    uint64_t num_keys = 0, kindx = 0;
+    for (indx = 0; indx < NUM_PARTITIONS; indx++) {
+        num_keys += merger.keys[indx].num_keys;
+    }
+    KeyOrigin* keys = (KeyOrigin*)CkallocOrDie(num_keys * sizeof(KeyOrigin));
+    for (indx = 0; indx < NUM_PARTITIONS; indx++) {
+        memcpy(keys + kindx, merger.keys[indx].keys, 
+               merger.keys[indx].num_keys * sizeof(KeyOrigin));
+        kindx += merger.keys[indx].num_keys;
+        if (merger.keys[indx].keys) Ckfree(merger.keys[indx].keys);
+    }
+    qsort(keys, num_keys, sizeof(KeyOrigin), CompareKeyOrigins);
+
+    SparseBlockHashMap blocks;
+    for (kindx = 0; kindx < num_keys; kindx++) {
+        blocks[keys[kindx].key] = 
+            merger.blocks[keys[kindx].partition][keys[kindx].key];
+    }
+    Ckfree(keys);
+    Ckfree(merger.keys);
+    delete[] merger.blocks;
+
+    // lets pass on the merged blocks
+    SparseBlockHashMap::iterator it;
+    uint bindex = 1;
+    MergedBlock merged;
+    memset(&merged, 0, sizeof(MergedBlock));
+    for (it = blocks.begin(); it != blocks.end(); it++) {
+        GetMotifInKey(&(*it).first, fmotif);
+
+        VisitBlocks((*it).second, fmotif, min_threshold, max_threshold,
+                    include_all, &bindex, &merged, visit, visit_arg);
+    }
+    FreeMergedBlock(&merged);
+
+    // the blocks and their sequences are released with the arenas
+    uint64_t num_bytes = 0;
+    for (indx = 0; indx < num_threads; indx++) {
+        num_bytes += merger.arenas[indx].num_bytes;
+        FreeArena(merger.arenas + indx);
+    }
+    Ckfree(merger.arenas);
+    PrintDebugMessage("The blocks used %"PRIu64" bytes.", num_bytes);
+    EndPhase(MERGE_PHASE);
+}
+
+
+// a sorted run of reads on disk, and the read at its head
+typedef struct SortedRun_st {
+    FILE* fp;
+    STRRead read;
+    uint level;          // the number of times its reads have been merged
+} SortedRun;
+
+// The most runs that are merged at a time. Once there are these many runs
+// that have been merged the same number of times, they are merged into one,
+// so only a few of them are open at a time however many reads there are.
+#define MERGE_FAN_IN 64
+
+// order the reads by their key, and then by their position in the input
+static int CompareSTRReads(const void* a, const void* b)
+{
+    const STRRead* const r1 = (const STRRead*)a;
+    const STRRead* const r2 = (const STRRead*)b;
+    int result = CompareBlockKeys(&r1->key, &r2->key);
+    if (result != 0) return result;
+    if (r1->number < r2->number) return -1;
+    if (r1->number > r2->number) return 1;
+    return 0;
+}
+
+static void WriteOrDie(const void* const ptr, const size_t size, FILE* fp)
+{
+    if ((size > 0) && (fwrite(ptr, size, 1, fp) != 1)) {
+        PrintThenDie("Error in writing a sorted run");
+    }
+}
+
+static void ReadOrDie(void* const ptr, const size_t size, FILE* fp)
+{
+    if ((size > 0) && (fread(ptr, size, 1, fp) != 1)) {
+        PrintThenDie("Error in reading a sorted run");
+    }
+}
+
+// write the read to a sorted run
+static void WriteSTRRead(const STRRead* const read, FILE* fp)
+{
+    const FastqSequence* const sequence = &read->sequence;
+    uint32_t lengths[2];
+    lengths[0] = strlen(sequence->name);
+    lengths[1] = sequence->slen;
+
+    WriteOrDie(&read->number, sizeof(read->number), fp);
+    WriteOrDie(&read->key, sizeof(read->key), fp);
+    WriteOrDie(read->motif, sizeof(read->motif), fp);
+    WriteOrDie(&read->copies, sizeof(read->copies), fp);
+    WriteOrDie(&read->zstart, sizeof(read->zstart), fp);
+    WriteOrDie(&read->end, sizeof(read->end), fp);
+    WriteOrDie(lengths, sizeof(lengths), fp);
+    WriteOrDie(sequence->name, lengths[0], fp);
+    WriteOrDie(sequence->bases, lengths[1], fp);
+    WriteOrDie(sequence->quals, lengths[1], fp);
+}
+
+// read the length bytes at the current position in the run into the buffer
+static void ReadIntoBuffer(char** const buffer,
+                           size_t* const allocated,
+                           const size_t length,
+                           FILE* fp)
+{
+    if (*allocated < length + 1) {
+        *allocated = length + 1;
+        *buffer = (char*)CkreallocOrDie(*buffer, *allocated);
+    }
+    ReadOrDie(*buffer, length, fp);
+    (*buffer)[length] = '\0';
+}
+
+// read the next read in a sorted run. Returns FALSE at the end of the run.
+static Bool ReadSTRRead(STRRead* const read, FILE* fp)
+{
+    FastqSequence* const sequence = &read->sequence;
+    uint32_t lengths[2];
+
+    if (fread(&read->number, sizeof(read->number), 1, fp) != 1) {
+        if (ferror(fp)) PrintThenDie("Error in reading a sorted run");
+        return FALSE;
+    }
+    ReadOrDie(&read->key, sizeof(read->key), fp);
+    ReadOrDie(read->motif, sizeof(read->motif), fp);
+    ReadOrDie(&read->copies, sizeof(read->copies), fp);
+    ReadOrDie(&read->zstart, sizeof(read->zstart), fp);
+    ReadOrDie(&read->end, sizeof(read->end), fp);
+    ReadOrDie(lengths, sizeof(lengths), fp);
+    ReadIntoBuffer(&sequence->name, &sequence->name_length, lengths[0], fp);
+    ReadIntoBuffer(&sequence->bases, &sequence->bases_length, lengths[1], fp);
+    ReadIntoBuffer(&sequence->quals, &sequence->quals_length, lengths[1], fp);
+    sequence->slen = lengths[1];
+
+    return TRUE;
+}
+
+// Create a new run in tmpdir. The file is removed right away, so it goes away
+// with the program however that ends.
+static FILE* CreateSortedRun(const char* const tmpdir)
+{
+    char* path = (char*)CkallocOrDie(strlen(tmpdir) + 32);
+    sprintf(path, "%s/merge_STR_reads.XXXXXX", tmpdir);
+    int fd = mkstemp(path);
+    if ((fd == -1) && (errno == EMFILE)) {
+        struct rlimit limit;
+        getrlimit(RLIMIT_NOFILE, &limit);
+        PrintMessageThenDie("Too many sorted runs are open for the limit of "
+                            "%lu open files, use a larger --run_size",
+                            (unsigned long)limit.rlim_cur);
+    }
+    if (fd == -1) {
+        PrintMessageThenDie("Error in creating a sorted run in %s", tmpdir);
+    }
+    unlink(path);
+    Ckfree(path);
+
+    FILE* fp = fdopen(fd, "w+b");
+    if (fp == NULL) {
+        PrintMessageThenDie("Error in creating a sorted run in %s", tmpdir);
+    }
+    return fp;
+}
+
+// go back to the start of the run, once all its reads have been written
+static void RewindSortedRun(FILE* fp)
+{
+    if ((fflush(fp) != 0) || (fseek(fp, 0, SEEK_SET) != 0)) {
+        PrintThenDie("Error in writing a sorted run");
+    }
+}
+
+// close the run, and free the read at its head
+static void CloseSortedRun(SortedRun* const run)
+{
+    FastqSequence* const copy = &run->read.sequence;
+    if (copy->name) Ckfree(copy->name);
+    if (copy->bases) Ckfree(copy->bases);
+    if (copy->quals) Ckfree(copy->quals);
+    fclose(run->fp);
+    memset(run, 0, sizeof(SortedRun));
+}
+
+// sort the reads and write them to a new run in tmpdir
+static FILE* WriteSortedRun(STRRead* const reads,
+                            const uint num_reads,
+                            const char* const tmpdir)
+{
+    FILE* fp = CreateSortedRun(tmpdir);
+
+    qsort(reads, num_reads, sizeof(STRRead), CompareSTRReads);
+    for (uint indx = 0; indx < num_reads; indx++) {
+        WriteSTRRead(reads + indx, fp);
+    }
+    RewindSortedRun(fp);
+
+    return fp;
+}
+
+// restore the heap property of the runs below position indx in the heap
+static void SiftDownRuns(SortedRun* const runs,
+                         uint* const heap,
+                         const uint num_heap,
+                         uint indx)
+{
+    while (2 * indx + 1 < num_heap) {
+        uint child = 2 * indx + 1;
+        if ((child + 1 < num_heap) &&
+            (CompareSTRReads(&runs[heap[child + 1]].read, 
+                             &runs[heap[child]].read) < 0)) {
+            child++;
+        }
+        if (CompareSTRReads(&runs[heap[child]].read, 
+                            &runs[heap[indx]].read) >= 0) {
+            break;
+        }
+        uint tmp = heap[indx];
+        heap[indx] = heap[child];
+        heap[child] = tmp;
+        indx = child;
+    }
+}
+
+// Merge the last num_merged runs into a new run in tmpdir, which takes their
+// place. Returns the number of runs that are left.
+static uint MergeSortedRuns(SortedRun* const runs,
+                            const uint num_runs,
+                            const uint num_merged,
+                            const char* const tmpdir)
+{
+    const uint first = num_runs - num_merged;
+    uint heap[MERGE_FAN_IN];
+    uint num_heap = 0, indx;
+
+    for (indx = first; indx < num_runs; indx++) {
+        if (ReadSTRRead(&runs[indx].read, runs[indx].fp) == TRUE) {
+            heap[num_heap++] = indx;
+        }
+    }
+    for (indx = num_heap / 2; indx > 0; indx--) {
+        SiftDownRuns(runs, heap, num_heap, indx - 1);
+    }
+
+    FILE* fp = CreateSortedRun(tmpdir);
+    while (num_heap > 0) {
+        WriteSTRRead(&runs[heap[0]].read, fp);
+        if (ReadSTRRead(&runs[heap[0]].read, runs[heap[0]].fp) == FALSE) {
+            heap[0] = heap[--num_heap];
+        }
+        SiftDownRuns(runs, heap, num_heap, 0);
+    }
+    RewindSortedRun(fp);
+
+    const uint level = runs[first].level + 1;
+    for (indx = first; indx < num_runs; indx++) {
+        CloseSortedRun(runs + indx);
+    }
+    runs[first].fp = fp;
+    runs[first].level = level;
+    return first + 1;
+}
+
+// The reads are first written in sorted runs of run_size reads to tmpdir. The
+// runs are then merged, so all the reads with a key are seen together and in 
+// the order of the input. The blocks for a key are passed on as soon as its 
+// last read is merged, and their memory is reused for the next key. So the 
+// memory needed depends on the largest set of reads with the same key, and on
+// the size of a run. The blocks are the same as the ones we get in memory, but
+// they are passed on in the order of their keys.
+void MergeShortTandemRepeatReadsOnDisk(const uint klength, 
+                                       STRReadSource* const source,
+                                       const uint progress_chunk,
+                                       const uint min_threshold,
+                                       const uint max_threshold,
+                                       const Bool include_all,
+                                       const Bool use_filter,
+                                       const char* const tmpdir,
+                                       const uint run_size,
+                                       BlockVisitor visit,
+                                       void* const visit_arg)
+{
+    uint64_t num_sequence_processed = 0;
+    uint num_runs = 0, runs_allocated = 0, num_reads, indx;
+    SortedRun* runs = NULL;
+    StartPhase(MERGE_PHASE);
+
+    STRRead* reads = (STRRead*)CkalloczOrDie(run_size * sizeof(STRRead));
+
+    while (source->sequence) {
+        const uint64_t start = GetTraceTime();
+        for (num_reads = 0; 
+             (source->sequence != NULL) && (num_reads < run_size); 
+             num_reads++) {
+            // print progress
+            num_sequence_processed += 1;
+            if ((debug_flag == FALSE) &&
+                ((num_sequence_processed - 1) % progress_chunk == 0)) {
+                PrintDebugMessage("Processing read number %"PRIu64": %s",
+                num_sequence_processed, source->sequence->name + 1);
+            }
+
+            PrepareSTRRead(reads + num_reads, source, num_sequence_processed,
+                           klength);
+            AdvanceSTRReadSource(source);
+        }
+
+        if (num_runs == runs_allocated) {
+            runs_allocated = runs_allocated ? 2 * runs_allocated : 16;
+            runs = (SortedRun*)CkreallocOrDie(runs, 
+                                              runs_allocated*sizeof(SortedRun));
+        }
+        memset(runs + num_runs, 0, sizeof(SortedRun));
+        runs[num_runs++].fp = WriteSortedRun(reads, num_reads, tmpdir);
+        TraceSpan("sorted_run", start, NULL, num_reads);
+
+        // the runs are in the order they were written, so the ones that have
+        // been merged the fewest times are at the end
+        while ((num_runs >= MERGE_FAN_IN) &&
+               (runs[num_runs - MERGE_FAN_IN].level ==
+                runs[num_runs - 1].level)) {
+            num_runs = MergeSortedRuns(runs, num_runs, MERGE_FAN_IN, tmpdir);
+        }
+    }
+    while (num_runs > MERGE_FAN_IN) {
+        num_runs = MergeSortedRuns(runs, num_runs, MERGE_FAN_IN, tmpdir);
+    }
+    PrintDebugMessage("Wrote %"PRIu64" reads in %u sorted runs.", 
+                      num_sequence_processed, num_runs);
+    if (source->scanner != NULL) {
+        PrintDebugMessage("Scanned %"PRIu64" reads.", source->num_scanned);
+    }
+    AddToCounter(MERGED_READS, num_sequence_processed);
+    AddToCounter(SCANNED_READS, source->num_scanned);
+
+    for (indx = 0; indx < run_size; indx++) {
+        FastqSequence* const copy = &reads[indx].sequence;
+        if (copy->name) Ckfree(copy->name);
+        if (copy->bases) Ckfree(copy->bases);
+        if (copy->quals) Ckfree(copy->quals);
+    }
+    Ckfree(reads);
+
+    // the runs are kept in a heap by the read at their head
+    uint* heap = (uint*)CkallocOrDie((num_runs + 1) * sizeof(uint));
+    uint num_heap = 0;
+    for (indx = 0; indx < num_runs; indx++) {
+        if (ReadSTRRead(&runs[indx].read, runs[indx].fp) == TRUE) {
+            heap[num_heap++] = indx;
+        }
+    }
+    for (indx = num_heap / 2; indx > 0; indx--) {
+        SiftDownRuns(runs, heap, num_heap, indx - 1);
+    }
+
+    AlignBuffer align_buffer;
+    memset(&align_buffer, 0, sizeof(AlignBuffer));
+    FilterStats filter_stats;
+    memset(&filter_stats, 0, sizeof(FilterStats));
+    Arena arena;
+    InitArena(&arena, ARENA_CHUNK_SIZE);
+
+    Block* blocks = NULL;
+    BlockKey key;
+    char fmotif[7];
+    uint bindex = 1;
+    MergedBlock merged;
+    memset(&merged, 0, sizeof(MergedBlock));
+    uint64_t num_keys = 0, max_group = 0, group = 0, group_start = 0;
+
+    // the reads are merged as the runs are read, so the time to read them is
+    // part of the alignments
+    StartPhase(ALIGNMENT_PHASE);
+    while (num_heap > 0) {
+        STRRead* const read = &runs[heap[0]].read;
+
+        // pass on the blocks of the previous key once we are past its reads
+        if ((blocks != NULL) && (CompareBlockKeys(&read->key, &key) != 0)) {
+            GetMotifInKey(&key, fmotif);
+            VisitBlocks(blocks, fmotif, min_threshold, max_threshold,
+                        include_all, &bindex, &merged, visit, visit_arg);
+            max_group = MAX(max_group, group);
+            if (group >= TRACE_GROUP_SIZE) {
+                TraceSpan("key_group", group_start, fmotif, group);
+            }
+            ResetArena(&arena);
+            blocks = NULL;
+        }
+        if (blocks == NULL) {
+            key = read->key;
+            group = 0;
+            group_start = GetTraceTime();
+            num_keys++;
+        }
+        group++;
+
+        if ((blocks == NULL) ||
+            (MergeIntoBlocks(blocks, &read->sequence, read->motif, 
+                             read->copies, read->zstart, read->end,
+                             max_threshold, &align_buffer, &arena,
+                             use_filter ? &filter_stats : NULL) == FALSE)) {
+            Block* block = NewBlock(&read->sequence, read->copies, 
+                                    read->zstart, read->end, &arena);
+            SllAddHead(&blocks, block);
+        }
+
+        // move on to the next read in this run
+        if (ReadSTRRead(read, runs[heap[0]].fp) == FALSE) {
+            heap[0] = heap[--num_heap];
+        }
+        SiftDownRuns(runs, heap, num_heap, 0);
+    }
+    if (blocks != NULL) {
+        GetMotifInKey(&key, fmotif);
+        VisitBlocks(blocks, fmotif, min_threshold, max_threshold,
+                    include_all, &bindex, &merged, visit, visit_arg);
+        max_group = MAX(max_group, group);
+        if (group >= TRACE_GROUP_SIZE) {
+            TraceSpan("key_group", group_start, fmotif, group);
+        }
+    }
+    EndPhase(ALIGNMENT_PHASE);
+    FreeMergedBlock(&merged);
+    PrintDebugMessage("Merged the reads for %"PRIu64" keys, with at most "
+                      "%"PRIu64" reads for a key.", num_keys, max_group);
+
+    if (use_filter == TRUE) {
+        ReportFilterStats(&filter_stats, 1);
+    }
+
+    FreeArena(&arena);
+    if (align_buffer.scores) Ckfree(align_buffer.scores);
+    if (align_buffer.trace) Ckfree(align_buffer.trace);
+    for (indx = 0; indx < 4; indx++) {
+        if (align_buffer.flanks[indx].words) {
+            Ckfree(align_buffer.flanks[indx].words);
+        }
+    }
+    if (align_buffer.lseq) Ckfree(align_buffer.lseq);
+    if (align_buffer.lqual) Ckfree(align_buffer.lqual);
+    if (align_buffer.rseq) Ckfree(align_buffer.rseq);
+    if (align_buffer.rqual) Ckfree(align_buffer.rqual);
+
+    for (indx = 0; indx < num_runs; indx++) {
+        CloseSortedRun(runs + indx);
+    }
+    if (runs) Ckfree(runs);
+    Ckfree(heap);
+    EndPhase(MERGE_PHASE);
+}
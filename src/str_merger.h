@@ -0,0 +1,99 @@
+#ifndef STR_MERGER_H_
+#define STR_MERGER_H_
+
+extern "C" {
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include <inttypes.h>
+
+#include "utilities.h"
+#include "fastq_seq.h"
+#include "str_scanner.h"
+#include "merged_block.h"
+#include "str_record.h"
+#include "metrics.h"
+}
+
+// the number of reads in a sorted run by default
+#define RUN_SIZE "1000000"
+
+// the function that is passed every read in the files of a source
+typedef void (*ReadVisitor)(void* const arg,
+                            const FastqSequence* const sequence);
+
+// the function that is passed every block that is merged
+typedef void (*BlockVisitor)(void* const arg, const MergedBlock* const block);
+
+// Where the STR reads come from. Either a file of STR reads whose names have
+// the STR on either strand, a binary file of STR reads from str_record.h, or
+// fastq files whose reads are scanned for STRs as they are read. In the latter
+// case the STRs are never written out as text, unless the selected reads are
+// asked for.
+typedef struct STRReadSource_st {
+    char** fqnames;
+    uint num_files;
+    uint findex;                  // the file that is being read
+    Bool illumina_quals;
+    const STRScanner* scanner;    // NULL for a file of STR reads
+    FastqSequence* sequence;      // the next STR read, NULL at the end
+    TandemRepeat repeat;          // and the STR on either strand when scanned
+    TandemRepeat rc_repeat;       // or read from a binary file
+    RecordReader* records;        // the binary file that is being read
+    FastqSequence record;         // and the read from it
+    uint64_t num_scanned;         // the reads that were scanned
+    FILE* selected;               // the scanned STR reads are written here
+
+    // every read in the files is passed to this, if it is set
+    ReadVisitor visit;
+    void* visit_arg;
+} STRReadSource;
+
+// Open the files and move to the first STR read. A file of STR reads can be
+// in fastq format or binary. The reads are scanned for
+// STRs with the scanner, unless it is NULL. Every read is also passed to
+// visit, unless it is NULL. The reads that the scanner selects are written to
+// selected the way scan_STR_reads prints them, unless it is NULL.
+void OpenSTRReadSource(STRReadSource* const source,
+                       char** const fqnames,
+                       const uint num_files,
+                       const Bool illumina_quals,
+                       const STRScanner* const scanner,
+                       FILE* const selected,
+                       ReadVisitor visit,
+                       void* const visit_arg);
+
+// Move to the next STR read in the source, skipping the reads without one on
+// both the strands if the reads are scanned.
+void AdvanceSTRReadSource(STRReadSource* const source);
+
+// Merge the STR reads in the source into blocks, in memory with num_threads
+// threads. The blocks that have between min_threshold and max_threshold reads
+// and two alleles, or one with include_all, are passed to visit one after the
+// other. The block is only valid during the call.
+void MergeShortTandemRepeatReads(const uint klength,
+                                 STRReadSource* const source,
+                                 const uint progress_chunk,
+                                 const uint min_threshold,
+                                 const uint max_threshold,
+                                 const Bool include_all,
+                                 const Bool use_filter,
+                                 const uint num_threads,
+                                 BlockVisitor visit,
+                                 void* const visit_arg);
+
+// Same as above, but the reads are merged in sorted runs of run_size reads
+// written to tmpdir, and the blocks are passed in the order of their keys.
+void MergeShortTandemRepeatReadsOnDisk(const uint klength,
+                                       STRReadSource* const source,
+                                       const uint progress_chunk,
+                                       const uint min_threshold,
+                                       const uint max_threshold,
+                                       const Bool include_all,
+                                       const Bool use_filter,
+                                       const char* const tmpdir,
+                                       const uint run_size,
+                                       BlockVisitor visit,
+                                       void* const visit_arg);
+
+#endif  // STR_MERGER_H_
@@ -0,0 +1,406 @@
+#include "str_record.h"
+
+// the start of every file of records
+static const char record_magic[4] = {'S', 'T', 'R', 'B'};
+#define RECORD_VERSION 1
+#define RECORD_HEADER_LENGTH 8
+
+// the fixed width fields of the STR on one strand of a read: the period, the
+// copies, zstart and end
+#define STR_FIELDS_LENGTH 11
+
+// the fixed width fields of a block: the length of the motif, the motif, the
+// copies of both the alleles, zstart and end
+#define BLOCK_FIELDS_LENGTH 15
+
+// a base that is not one of these is written as a run of that base
+static Bool IsPackedBase(const char base) {
+    return (base == 'A' || base == 'C' || base == 'G' || base == 'T');
+}
+
+static void PutUint16(uchar* const buffer, const uint value) {
+    buffer[0] = value & 0xff;
+    buffer[1] = (value >> 8) & 0xff;
+}
+
+static void PutUint32(uchar* const buffer, const uint32_t value) {
+    buffer[0] = value & 0xff;
+    buffer[1] = (value >> 8) & 0xff;
+    buffer[2] = (value >> 16) & 0xff;
+    buffer[3] = (value >> 24) & 0xff;
+}
+
+static uint GetUint16(const uchar* const buffer) {
+    return buffer[0] | (buffer[1] << 8);
+}
+
+static uint32_t GetUint32(const uchar* const buffer) {
+    return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) |
+           ((uint32_t)buffer[3] << 24);
+}
+
+// make sure there is room for length more bytes in the record
+static uchar* ReserveRecord(RecordWriter* const writer, const size_t length) {
+    if (writer->length + length > writer->allocated) {
+        writer->allocated = 2 * (writer->length + length);
+        writer->buffer = CkreallocOrDie(writer->buffer, writer->allocated);
+    }
+    uchar* const next = writer->buffer + writer->length;
+    writer->length += length;
+    return next;
+}
+
+static void AppendUint8(RecordWriter* const writer, const uint value) {
+    *ReserveRecord(writer, 1) = value;
+}
+
+// the value has to fit in the field of the record
+static void AppendUint16(RecordWriter* const writer,
+                         const uint value,
+                         const char* const field) {
+    if (value > 0xffff) {
+        PrintMessageThenDie("The %s %u is too large for a record", field, value);
+    }
+    PutUint16(ReserveRecord(writer, 2), value);
+}
+
+static void AppendUint32(RecordWriter* const writer, const uint32_t value) {
+    PutUint32(ReserveRecord(writer, 4), value);
+}
+
+static void AppendName(RecordWriter* const writer, const char* const name) {
+    const size_t length = strlen(name);
+    AppendUint16(writer, length, "length of the name");
+    memcpy(ReserveRecord(writer, length), name, length);
+}
+
+// Append the bases packed with 2 bits per base, the runs of the bases that are
+// not ACGT, and the runs of the quality values.
+static void AppendSequence(RecordWriter* const writer,
+                           const char* const bases,
+                           const char* const quals,
+                           const uint slen) {
+    uint indx, jndx;
+
+    AppendUint32(writer, slen);
+    uchar* const packed = ReserveRecord(writer, (slen + 3) / 4);
+    memset(packed, 0, (slen + 3) / 4);
+    for (indx = 0; indx < slen; indx++) {
+        if (IsPackedBase(bases[indx]) == FALSE) continue;
+        packed[indx / 4] |= fasta_encoding[(int)bases[indx]] << (2*(indx % 4));
+    }
+
+    size_t count_at = writer->length;
+    uint num_runs = 0;
+    AppendUint32(writer, 0);
+    for (indx = 0; indx < slen; indx = jndx) {
+        for (jndx = indx + 1;
+             (jndx < slen) && (bases[jndx] == bases[indx]);
+             jndx++);
+        if (IsPackedBase(bases[indx]) == TRUE) continue;
+        AppendUint32(writer, indx);
+        AppendUint32(writer, jndx - indx);
+        AppendUint8(writer, (uchar)bases[indx]);
+        num_runs++;
+    }
+    PutUint32(writer->buffer + count_at, num_runs);
+
+    count_at = writer->length;
+    num_runs = 0;
+    AppendUint32(writer, 0);
+    for (indx = 0; indx < slen; indx = jndx) {
+        for (jndx = indx + 1;
+             (jndx < slen) && (jndx - indx < 255) &&
+             (quals[jndx] == quals[indx]);
+             jndx++);
+        AppendUint8(writer, jndx - indx);
+        AppendUint8(writer, (uchar)quals[indx]);
+        num_runs++;
+    }
+    PutUint32(writer->buffer + count_at, num_runs);
+}
+
+static void AppendRepeat(RecordWriter* const writer,
+                         const TandemRepeat* const repeat) {
+    AppendUint8(writer, repeat->period);
+    AppendUint16(writer, repeat->copies, "number of copies");
+    AppendUint32(writer, repeat->zstart);
+    AppendUint32(writer, repeat->end);
+}
+
+static void FlushRecord(RecordWriter* const writer) {
+    if (fwrite(writer->buffer, 1, writer->length, writer->fp) !=
+        writer->length) {
+        PrintThenDie("Error in writing a record");
+    }
+    writer->length = 0;
+}
+
+RecordWriter* NewRecordWriter(FILE* const fp, const uint kind) {
+    RecordWriter* const writer = CkalloczOrDie(sizeof(RecordWriter));
+    writer->fp = fp;
+
+    memcpy(ReserveRecord(writer, 4), record_magic, 4);
+    AppendUint16(writer, RECORD_VERSION, "version");
+    AppendUint16(writer, kind, "kind");
+    FlushRecord(writer);
+    return writer;
+}
+
+void WriteSTRReadRecord(RecordWriter* const writer,
+                        const FastqSequence* const sequence,
+                        const TandemRepeat* const repeat,
+                        const TandemRepeat* const rc_repeat) {
+    AppendName(writer, sequence->name);
+    AppendRepeat(writer, repeat);
+    AppendRepeat(writer, rc_repeat);
+    AppendSequence(writer, sequence->bases, sequence->quals, sequence->slen);
+    FlushRecord(writer);
+}
+
+void WriteMergedBlockRecord(RecordWriter* const writer,
+                            const MergedBlock* const block) {
+    const uint motif_length = strlen(block->motif);
+    uint motif = 0, copies[2] = {0, 0};
+    uint indx;
+
+    for (indx = 0; indx < motif_length; indx++) {
+        if (IsPackedBase(block->motif[indx]) == FALSE) {
+            PrintMessageThenDie("The motif %s of %s should only have ACGT",
+                                block->motif, block->name);
+        }
+        motif = (motif << 2) | fasta_encoding[(int)block->motif[indx]];
+    }
+    if (sscanf(block->copies, "%u,%u", copies, copies + 1) < 1) {
+        PrintMessageThenDie("Error in the copies %s of %s", block->copies,
+                            block->name);
+    }
+    ForceAssert((block->zstart >= 0) && (block->end >= block->zstart));
+
+    AppendName(writer, block->name);
+    AppendUint8(writer, motif_length);
+    AppendUint16(writer, motif, "motif");
+    AppendUint16(writer, copies[0], "number of copies");
+    AppendUint16(writer, copies[1], "number of copies");
+    AppendUint32(writer, block->zstart);
+    AppendUint32(writer, block->end);
+    AppendSequence(writer, block->bases, block->quals, block->slen);
+    FlushRecord(writer);
+}
+
+void FreeRecordWriter(RecordWriter** const pwriter) {
+    RecordWriter* const writer = *pwriter;
+    fflush(writer->fp);
+    if (writer->buffer) Ckfree(writer->buffer);
+    Ckfree(writer);
+    *pwriter = NULL;
+}
+
+// read the next length bytes of the record into the buffer of the reader
+static const uchar* ReadRecordBytes(RecordReader* const reader,
+                                    const size_t length) {
+    if (reader->allocated < length) {
+        reader->allocated = 2 * length;
+        reader->buffer = CkreallocOrDie(reader->buffer, reader->allocated);
+    }
+    if ((length > 0) &&
+        (gzread(reader->fd, reader->buffer, length) != (int)length)) {
+        PrintMessageThenDie("%s is truncated", reader->fname);
+    }
+    return reader->buffer;
+}
+
+static uint32_t ReadUint32(RecordReader* const reader) {
+    return GetUint32(ReadRecordBytes(reader, 4));
+}
+
+// Read the length of the name that starts the next record. Returns FALSE at
+// the end of the file.
+static Bool ReadNameLength(RecordReader* const reader, uint* const length) {
+    uchar buffer[2];
+    const int num_read = gzread(reader->fd, buffer, 2);
+    if (num_read == 0) return FALSE;
+    if (num_read != 2) {
+        PrintMessageThenDie("%s is truncated", reader->fname);
+    }
+    *length = GetUint16(buffer);
+    return TRUE;
+}
+
+// read a string of this length into the buffer, growing it if needed
+static void ReadString(RecordReader* const reader,
+                       char** const buffer,
+                       size_t* const allocated,
+                       const size_t length) {
+    if (*allocated < length + 1) {
+        *allocated = length + 1;
+        *buffer = CkreallocOrDie(*buffer, *allocated);
+    }
+    memcpy(*buffer, ReadRecordBytes(reader, length), length);
+    (*buffer)[length] = '\0';
+}
+
+// Read the bases and the quals written by AppendSequence. There should be room
+// for slen + 1 characters in both.
+static void ReadSequence(RecordReader* const reader,
+                         char* const bases,
+                         char* const quals,
+                         const uint slen) {
+    const uchar* buffer;
+    uint num_runs, indx, jndx;
+
+    buffer = ReadRecordBytes(reader, (slen + 3) / 4);
+    for (indx = 0; indx < slen; indx++) {
+        bases[indx] = bit_encoding[(buffer[indx / 4] >> (2*(indx % 4))) & 3];
+    }
+    bases[slen] = '\0';
+
+    num_runs = ReadUint32(reader);
+    buffer = ReadRecordBytes(reader, 9 * (size_t)num_runs);
+    for (indx = 0; indx < num_runs; indx++, buffer += 9) {
+        const uint32_t start = GetUint32(buffer);
+        const uint32_t length = GetUint32(buffer + 4);
+        if ((start > slen) || (length > slen - start)) {
+            PrintMessageThenDie("The bases of a record in %s are corrupt",
+                                reader->fname);
+        }
+        memset(bases + start, buffer[8], length);
+    }
+
+    num_runs = ReadUint32(reader);
+    buffer = ReadRecordBytes(reader, 2 * (size_t)num_runs);
+    for (indx = 0, jndx = 0; indx < num_runs; indx++, buffer += 2) {
+        if (buffer[0] > slen - jndx) {
+            PrintMessageThenDie("The quality values of a record in %s are "
+                                "corrupt", reader->fname);
+        }
+        memset(quals + jndx, buffer[1], buffer[0]);
+        jndx += buffer[0];
+    }
+    if (jndx != slen) {
+        PrintMessageThenDie("The quality values of a record in %s are "
+                                "corrupt", reader->fname);
+    }
+    quals[slen] = '\0';
+}
+
+static void GetRepeat(const RecordReader* const reader,
+                      TandemRepeat* const repeat,
+                      const uchar* const buffer) {
+    repeat->period = buffer[0];
+    repeat->copies = GetUint16(buffer + 1);
+    repeat->zstart = GetUint32(buffer + 3);
+    repeat->end = GetUint32(buffer + 7);
+    if ((repeat->period == 0) || (repeat->period > MAX_PERIOD)) {
+        PrintMessageThenDie("The STR of a record in %s is corrupt",
+                            reader->fname);
+    }
+}
+
+RecordReader* OpenRecordReader(const char* const fname, const uint kind) {
+    uchar header[RECORD_HEADER_LENGTH];
+    gzFile fd = gzopen(fname, "r");
+    if (fd == NULL) return NULL;
+
+    if ((gzread(fd, header, RECORD_HEADER_LENGTH) != RECORD_HEADER_LENGTH) ||
+        (memcmp(header, record_magic, 4) != 0)) {
+        gzclose(fd);
+        return NULL;
+    }
+    if (GetUint16(header + 4) != RECORD_VERSION) {
+        PrintMessageThenDie("%s has records of version %u, expected %u",
+                            fname, GetUint16(header + 4), RECORD_VERSION);
+    }
+    if (GetUint16(header + 6) != kind) {
+        PrintMessageThenDie("%s has %s, expected %s", fname,
+            kind == STR_READ_RECORDS ? "merged blocks" : "STR reads",
+            kind == STR_READ_RECORDS ? "STR reads" : "merged blocks");
+    }
+
+    RecordReader* const reader = CkalloczOrDie(sizeof(RecordReader));
+    reader->fname = CopyString(fname);
+    reader->fd = fd;
+    reader->kind = kind;
+    return reader;
+}
+
+Bool ReadSTRReadRecord(RecordReader* const reader,
+                       FastqSequence* const sequence,
+                       TandemRepeat* const repeat,
+                       TandemRepeat* const rc_repeat) {
+    uint name_length;
+    ForceAssert(reader->kind == STR_READ_RECORDS);
+    if (ReadNameLength(reader, &name_length) == FALSE) return FALSE;
+    ReadString(reader, &sequence->name, &sequence->name_length, name_length);
+
+    const uchar* const fields = ReadRecordBytes(reader, 2 * STR_FIELDS_LENGTH);
+    GetRepeat(reader, repeat, fields);
+    GetRepeat(reader, rc_repeat, fields + STR_FIELDS_LENGTH);
+
+    const uint slen = ReadUint32(reader);
+    if (sequence->bases_length < slen + 1) {
+        sequence->bases_length = slen + 1;
+        sequence->bases = CkreallocOrDie(sequence->bases, slen + 1);
+    }
+    if (sequence->quals_length < slen + 1) {
+        sequence->quals_length = slen + 1;
+        sequence->quals = CkreallocOrDie(sequence->quals, slen + 1);
+    }
+    ReadSequence(reader, sequence->bases, sequence->quals, slen);
+    sequence->slen = slen;
+
+    if ((repeat->end > slen) || (rc_repeat->end > slen)) {
+        PrintMessageThenDie("The STR of %s is corrupt", sequence->name + 1);
+    }
+    return TRUE;
+}
+
+Bool ReadMergedBlockRecord(RecordReader* const reader,
+                           MergedBlock* const block) {
+    uint name_length, indx;
+    ForceAssert(reader->kind == MERGED_BLOCK_RECORDS);
+    if (ReadNameLength(reader, &name_length) == FALSE) return FALSE;
+    ReadString(reader, &block->name, &block->name_allocated, name_length);
+
+    const uchar* const fields = ReadRecordBytes(reader, BLOCK_FIELDS_LENGTH);
+    const uint motif_length = fields[0];
+    const uint motif = GetUint16(fields + 1);
+    const uint copies = GetUint16(fields + 3);
+    const uint copies2 = GetUint16(fields + 5);
+    block->zstart = GetUint32(fields + 7);
+    block->end = GetUint32(fields + 11);
+    if ((motif_length == 0) || (motif_length > MAX_PERIOD)) {
+        PrintMessageThenDie("The motif of %s is corrupt", block->name);
+    }
+    for (indx = 0; indx < motif_length; indx++) {
+        block->motif[indx] =
+            bit_encoding[(motif >> (2 * (motif_length - indx - 1))) & 3];
+    }
+    block->motif[motif_length] = '\0';
+
+    // room for two numbers of up to 5 digits
+    if (block->copies_allocated < 12) {
+        block->copies_allocated = 12;
+        block->copies = CkreallocOrDie(block->copies, 12);
+    }
+    if (copies2 == 0) {
+        sprintf(block->copies, "%u", copies);
+    } else {
+        sprintf(block->copies, "%u,%u", copies, copies2);
+    }
+
+    const uint slen = ReadUint32(reader);
+    ReserveMergedBlock(block, slen);
+    ReadSequence(reader, block->bases, block->quals, slen);
+    block->slen = slen;
+    return TRUE;
+}
+
+void CloseRecordReader(RecordReader** const preader) {
+    RecordReader* const reader = *preader;
+    gzclose(reader->fd);
+    Ckfree(reader->fname);
+    if (reader->buffer) Ckfree(reader->buffer);
+    Ckfree(reader);
+    *preader = NULL;
+}
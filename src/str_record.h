@@ -0,0 +1,78 @@
+#ifndef STR_RECORD_H_
+#define STR_RECORD_H_
+
+#include <stdio.h>
+#include <zlib.h>
+
+#include "utilities.h"
+#include "fastq_seq.h"
+#include "str_scanner.h"
+#include "merged_block.h"
+
+// A binary format for the STR reads written by scan_STR_reads and the blocks
+// written by merge_STR_reads, so the tool that reads them does not have to
+// parse the names of the reads. A file starts with a magic number, the
+// version of the format and the kind of the records in it. Every record has
+//   the name, as a 16 bit length and the characters
+//   the STR, in fixed width fields
+//   the number of bases, and the bases packed with 2 bits per base
+//   the runs of bases that are not one of ACGT, e.g. N
+//   the runs of the same quality value
+// All the numbers are little endian.
+
+// the kinds of records
+#define STR_READ_RECORDS     1  // STR reads, with the STR on either strand
+#define MERGED_BLOCK_RECORDS 2  // blocks of merged STR reads
+
+typedef struct RecordWriter_st {
+    FILE* fp;
+    uchar* buffer;      // the record that is being written
+    size_t length;
+    size_t allocated;
+} RecordWriter;
+
+typedef struct RecordReader_st {
+    char* fname;
+    gzFile fd;
+    uint kind;
+    uchar* buffer;      // the part of the record that is being read
+    size_t allocated;
+} RecordReader;
+
+// Start a file of records of this kind in fp.
+RecordWriter* NewRecordWriter(FILE* const fp, const uint kind);
+
+// Write the STR read with the STR on either strand, the way scan_STR_reads
+// selects it. The name is written as it is, with the @.
+void WriteSTRReadRecord(RecordWriter* const writer,
+                        const FastqSequence* const sequence,
+                        const TandemRepeat* const repeat,
+                        const TandemRepeat* const rc_repeat);
+
+// Write the block, the way merge_STR_reads prints it.
+void WriteMergedBlockRecord(RecordWriter* const writer,
+                            const MergedBlock* const block);
+
+// flush the file, and free the writer
+void FreeRecordWriter(RecordWriter** const pwriter);
+
+// Open the file of records of this kind. Returns NULL if the file does not
+// start with the magic number, e.g. if it is a fastq file.
+RecordReader* OpenRecordReader(const char* const fname, const uint kind);
+
+// Read the next STR read into the sequence and the STR on either strand into
+// repeat and rc_repeat. The buffers of the sequence are grown as needed.
+// Returns FALSE at the end of the file.
+Bool ReadSTRReadRecord(RecordReader* const reader,
+                       FastqSequence* const sequence,
+                       TandemRepeat* const repeat,
+                       TandemRepeat* const rc_repeat);
+
+// Read the next block. Returns FALSE at the end of the file.
+Bool ReadMergedBlockRecord(RecordReader* const reader,
+                           MergedBlock* const block);
+
+// close the file, and free the reader
+void CloseRecordReader(RecordReader** const preader);
+
+#endif  // STR_RECORD_H_
@@ -0,0 +1,412 @@
+#include <ctype.h>
+
+#include "str_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define X86_KERNELS
+#endif
+
+static uint64_t MatchMaskScalar(const char* const bases, const uint period) {
+    uint64_t mask = 0;
+    uint indx;
+    for (indx = 0; indx < 64; indx++) {
+        mask |= (uint64_t)(bases[indx] == bases[indx + period]) << indx;
+    }
+    return mask;
+}
+
+#ifdef __SSE2__
+static uint64_t MatchMaskSSE2(const char* const bases, const uint period) {
+    uint64_t mask = 0;
+    uint indx;
+    for (indx = 0; indx < 64; indx += 16) {
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(bases + indx));
+        __m128i b2 = _mm_loadu_si128((const __m128i*)(bases + indx + period));
+        uint bits = (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(b1, b2));
+        mask |= (uint64_t)bits << indx;
+    }
+    return mask;
+}
+#endif
+
+#ifdef X86_KERNELS
+__attribute__((target("avx2")))
+static uint64_t MatchMaskAVX2(const char* const bases, const uint period) {
+    __m256i lo1 = _mm256_loadu_si256((const __m256i*)bases);
+    __m256i lo2 = _mm256_loadu_si256((const __m256i*)(bases + period));
+    __m256i hi1 = _mm256_loadu_si256((const __m256i*)(bases + 32));
+    __m256i hi2 = _mm256_loadu_si256((const __m256i*)(bases + 32 + period));
+    uint lo = (uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo1, lo2));
+    uint hi = (uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi1, hi2));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+__attribute__((target("avx512bw")))
+static uint64_t MatchMaskAVX512(const char* const bases, const uint period) {
+    __m512i b1 = _mm512_loadu_si512((const void*)bases);
+    __m512i b2 = _mm512_loadu_si512((const void*)(bases + period));
+    return _mm512_cmpeq_epi8_mask(b1, b2);
+}
+#endif
+
+// Return TRUE if the word has length consecutive bits that are set, with
+// 0 < length <= 64. Every step doubles the length of the runs we look for.
+static inline Bool HasRunInWord(uint64_t word, const uint length) {
+    uint found = 1;
+    while (2 * found <= length) {
+        word &= word >> found;
+        found *= 2;
+    }
+    if (found < length) word &= word >> (length - found);
+    return word != 0;
+}
+
+// Return TRUE if any of the periods has enough positions in a row where the
+// base is the same as the one a period later. Without them the read can not 
+// have a repeat with min_copies copies. With alt_algo, only the positions 
+// that a repeat with enough flank on either side could use are checked.
+static Bool HasLongEnoughRun(const STRScanner* const scanner,
+                             const char* const bases,
+                             const uint slen) {
+    uint period;
+
+    for (period = MIN_PERIOD; period <= MAX_PERIOD; period++) {
+        if ((scanner->periods[period] == FALSE) || (slen < period)) continue;
+
+        const uint needed = (scanner->min_copies - 1) * period;
+        if (needed == 0) return TRUE;
+
+        // the positions [zstart, end) are compared
+        uint zstart = 0;
+        uint end = slen - period;
+        if (scanner->alt_algo == TRUE) {
+            if (end < 2 * scanner->flank) continue;
+            zstart = scanner->flank;
+            end -= scanner->flank;
+        }
+        if (end < zstart + needed) continue;
+
+        uint run = 0, base;
+        for (base = zstart; base < end; base += 64) {
+            uint64_t mask;
+            if (base + 64 + period <= slen) {
+                mask = scanner->match_mask(bases + base, period);
+            } else {
+                mask = 0;
+                for (uint indx = 0; base + indx < slen - period; indx++) {
+                    mask |= (uint64_t)(bases[base + indx] == 
+                                       bases[base + indx + period]) << indx;
+                }
+            }
+            if (end - base < 64) mask &= (1ULL << (end - base)) - 1;
+
+            if (mask == ~0ULL) {
+                run += 64;
+                if (run >= needed) return TRUE;
+                continue;
+            }
+            if (run + __builtin_ctzll(~mask) >= needed) return TRUE;
+            if ((needed <= 64) && (HasRunInWord(mask, needed) == TRUE)) {
+                return TRUE;
+            }
+            run = __builtin_clzll(~mask);
+        }
+    }
+
+    return FALSE;
+}
+
+STRScanner* NewSTRScanner(const uint min_copies,
+                          const uint flank,
+                          const char* const periods,
+                          const Bool remove_homopolymers,
+                          const Bool alt_algo) {
+    STRScanner* const scanner = CkalloczOrDie(sizeof(STRScanner));
+    const char* iter;
+    uint period;
+
+    ForceAssert(min_copies > 0);
+
+    for (iter = periods; *iter; iter++) {
+        if ((*iter < '0' + MIN_PERIOD) || (*iter > '0' + MAX_PERIOD)) {
+            PrintMessageThenDie("The periods should be in [%d,%d]: %c",
+                                MIN_PERIOD, MAX_PERIOD, *iter);
+        }
+        scanner->periods[*iter - '0'] = TRUE;
+    }
+    if (*periods == '\0') {
+        for (period = MIN_PERIOD; period <= MAX_PERIOD; period++) {
+            scanner->periods[period] = TRUE;
+        }
+    }
+
+    scanner->min_copies = min_copies;
+    scanner->flank = flank;
+    scanner->remove_homopolymers = remove_homopolymers;
+    scanner->alt_algo = alt_algo;
+
+    scanner->match_mask = MatchMaskScalar;
+    scanner->kernel = "scalar";
+#ifdef __SSE2__
+    scanner->match_mask = MatchMaskSSE2;
+    scanner->kernel = "sse2";
+#endif
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        scanner->match_mask = MatchMaskAVX512;
+        scanner->kernel = "avx512bw";
+    } else if (__builtin_cpu_supports("avx2")) {
+        scanner->match_mask = MatchMaskAVX2;
+        scanner->kernel = "avx2";
+    }
+#endif
+
+    return scanner;
+}
+
+void FreeSTRScanner(STRScanner** pscanner) {
+    Ckfree(*pscanner);
+    *pscanner = NULL;
+}
+
+Bool NormalizeBases(char* const bases, const uint slen) {
+    uint indx;
+    for (indx = 0; indx < slen; indx++) {
+        if (strchr("acgtnACGTN.", bases[indx]) == NULL) return FALSE;
+        bases[indx] = toupper(bases[indx]);
+    }
+    return TRUE;
+}
+
+static Bool HasEnoughFlank(const STRScanner* const scanner,
+                           const TandemRepeat* const repeat,
+                           const uint slen) {
+    return (repeat->zstart >= scanner->flank) &&
+           (slen - repeat->end >= scanner->flank);
+}
+
+static Bool IsHomopolymer(const char* const motif, const uint period) {
+    uint indx;
+    for (indx = 1; indx < period; indx++) {
+        if (motif[indx] != motif[0]) return FALSE;
+    }
+    return TRUE;
+}
+
+// Return TRUE if the repeat can be reported. The bases in a repeat are the
+// same every period bases, so a motif has an N or is a homopolymer exactly
+// when the motif at the other end of the repeat, i.e. the one on the other
+// strand, does.
+static Bool IsCandidate(const STRScanner* const scanner,
+                        const char* const bases,
+                        const uint slen,
+                        const TandemRepeat* const repeat) {
+    // motifs with an N are never reported
+    if (memchr(bases + repeat->zstart, 'N', repeat->period) != NULL) {
+        return FALSE;
+    }
+
+    if (scanner->alt_algo == TRUE) {
+        if (HasEnoughFlank(scanner, repeat, slen) == FALSE) return FALSE;
+        if ((scanner->remove_homopolymers == TRUE) &&
+            (IsHomopolymer(bases + repeat->zstart, repeat->period) == TRUE)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+// Return TRUE if the repeat r1 is better than the repeat r2 on the strand of
+// the bases.
+static Bool IsBetterRepeat(const char* const bases,
+                           const TandemRepeat* const r1,
+                           const TandemRepeat* const r2) {
+    const uint len1 = r1->end - r1->zstart;
+    const uint len2 = r2->end - r2->zstart;
+    int cmp;
+
+    if (len1 != len2) return len1 > len2;
+    if (r1->copies != r2->copies) return r1->copies > r2->copies;
+    cmp = memcmp(bases + r1->zstart, bases + r2->zstart, len1);
+    if (cmp != 0) return cmp > 0;
+    return r1->zstart > r2->zstart;
+}
+
+static inline unsigned char Complement(const char base) {
+    switch (base) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        default: return base;
+    }
+}
+
+// Return TRUE if the repeat r1 is better than the repeat r2 on the other
+// strand. Both the repeats are on this strand, and are compared the way
+// IsBetterRepeat would compare them after the bases are reverse complemented.
+static Bool IsBetterRCRepeat(const char* const bases,
+                             const TandemRepeat* const r1,
+                             const TandemRepeat* const r2) {
+    const uint len1 = r1->end - r1->zstart;
+    const uint len2 = r2->end - r2->zstart;
+    uint indx;
+
+    if (len1 != len2) return len1 > len2;
+    if (r1->copies != r2->copies) return r1->copies > r2->copies;
+    for (indx = 1; indx <= len1; indx++) {
+        const unsigned char c1 = Complement(bases[r1->end - indx]);
+        const unsigned char c2 = Complement(bases[r2->end - indx]);
+        if (c1 != c2) return c1 > c2;
+    }
+
+    // the one that starts last on the other strand
+    return r1->end < r2->end;
+}
+
+// Find the best repeat on the other strand with one pass from the start of
+// the read, where the repeats are extended towards the start of the read.
+// This is the scan on the reverse complement, without building it. It is
+// only needed with alt_algo, since the flank is checked before the repeats
+// are compared.
+static Bool FindBestRCRepeat(const STRScanner* const scanner,
+                             const char* const bases,
+                             const uint slen,
+                             TandemRepeat* const rc_best) {
+    // runs[period] is the number of positions up to here where the base is
+    // the same as the one period bases earlier
+    uint runs[MAX_PERIOD + 1];
+    Bool found = FALSE;
+    TandemRepeat repeat;
+    uint period;
+    uint end;
+
+    memset(runs, 0, sizeof(runs));
+
+    for (end = 1; end <= slen; end++) {
+        for (period = MIN_PERIOD; period <= MAX_PERIOD; period++) {
+            if ((end > period) &&
+                (bases[end - 1] == bases[end - 1 - period])) {
+                runs[period]++;
+            } else {
+                runs[period] = 0;
+            }
+        }
+
+        for (period = MIN_PERIOD; period <= MAX_PERIOD; period++) {
+            if ((scanner->periods[period] == FALSE) || (end < period)) {
+                continue;
+            }
+
+            repeat.period = period;
+            repeat.copies = 1 + runs[period] / period;
+            if (repeat.copies < scanner->min_copies) continue;
+            repeat.end = end;
+            repeat.zstart = end - repeat.copies * period;
+            if (IsCandidate(scanner, bases, slen, &repeat) == FALSE) continue;
+
+            if ((found == FALSE) ||
+                (IsBetterRCRepeat(bases, &repeat, rc_best) == TRUE)) {
+                *rc_best = repeat;
+                found = TRUE;
+            }
+        }
+    }
+
+    return found;
+}
+
+// the filters that are applied to the best repeat when alt_algo is not set
+static Bool PassesFilters(const STRScanner* const scanner,
+                          const char* const bases,
+                          const uint slen,
+                          const TandemRepeat* const repeat) {
+    if (HasEnoughFlank(scanner, repeat, slen) == FALSE) return FALSE;
+    if ((scanner->remove_homopolymers == TRUE) &&
+        (IsHomopolymer(bases + repeat->zstart, repeat->period) == TRUE)) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+Bool FindBestTandemRepeats(const STRScanner* const scanner,
+                           const char* const bases,
+                           const uint slen,
+                           TandemRepeat* const best,
+                           TandemRepeat* const rc_best) {
+    // runs[period] is the number of positions from here on where the base is
+    // the same as the one period bases later
+    uint runs[MAX_PERIOD + 1];
+    Bool found = FALSE;
+    TandemRepeat repeat;
+    uint period;
+    int zstart;
+
+    // most reads do not have a repeat, and are turned away here. The check
+    // gives the same answer on either strand.
+    if (HasLongEnoughRun(scanner, bases, slen) == FALSE) return FALSE;
+
+    memset(runs, 0, sizeof(runs));
+
+    // one pass from the end of the read, for all the periods at once
+    for (zstart = (int)slen - 1; zstart >= 0; zstart--) {
+        for (period = MIN_PERIOD; period <= MAX_PERIOD; period++) {
+            if ((zstart + period < slen) &&
+                (bases[zstart] == bases[zstart + period])) {
+                runs[period]++;
+            } else {
+                runs[period] = 0;
+            }
+        }
+
+        for (period = MIN_PERIOD; period <= MAX_PERIOD; period++) {
+            if ((scanner->periods[period] == FALSE) ||
+                (zstart + period > slen)) {
+                continue;
+            }
+
+            repeat.period = period;
+            repeat.copies = 1 + runs[period] / period;
+            if (repeat.copies < scanner->min_copies) continue;
+            repeat.zstart = zstart;
+            repeat.end = zstart + repeat.copies * period;
+            if (IsCandidate(scanner, bases, slen, &repeat) == FALSE) continue;
+
+            if ((found == FALSE) ||
+                (IsBetterRepeat(bases, &repeat, best) == TRUE)) {
+                *best = repeat;
+            }
+
+            // Every placement of the longest repeats is a candidate on both
+            // the strands, so without alt_algo the best one on the other
+            // strand is among the ones we see here.
+            if ((scanner->alt_algo == FALSE) &&
+                ((found == FALSE) ||
+                 (IsBetterRCRepeat(bases, &repeat, rc_best) == TRUE))) {
+                *rc_best = repeat;
+            }
+            found = TRUE;
+        }
+    }
+
+    if (found == FALSE) return FALSE;
+
+    if (scanner->alt_algo == TRUE) {
+        if (FindBestRCRepeat(scanner, bases, slen, rc_best) == FALSE) {
+            return FALSE;
+        }
+    } else if ((PassesFilters(scanner, bases, slen, best) == FALSE) ||
+               (PassesFilters(scanner, bases, slen, rc_best) == FALSE)) {
+        return FALSE;
+    }
+
+    // the coordinates on the reverse complement
+    const uint rc_zstart = slen - rc_best->end;
+    rc_best->end = slen - rc_best->zstart;
+    rc_best->zstart = rc_zstart;
+
+    return TRUE;
+}
@@ -0,0 +1,81 @@
+#ifndef STR_SCANNER_H_
+#define STR_SCANNER_H_
+
+#include <inttypes.h>
+
+#include "utilities.h"
+
+// the periods of the motifs that we look for
+#define MIN_PERIOD 2
+#define MAX_PERIOD 6
+
+// an exact tandem repeat of a motif at [zstart, end) in a read
+typedef struct TandemRepeat_st {
+    uint period;
+    uint copies;
+    uint zstart;
+    uint end;
+} TandemRepeat;
+
+// Return a mask with bit j set if bases[j] is the same as bases[j + period],
+// for j in [0, 64). All the 64 + period bases have to be in the read.
+typedef uint64_t (*MatchMaskFunction)(const char* const bases,
+                                      const uint period);
+
+// which repeats should be reported by the scanner
+typedef struct STRScanner_st {
+    uint min_copies;              // at least these many copies of the motif
+    uint flank;                   // at least these many bases on either side
+    Bool periods[MAX_PERIOD + 1]; // TRUE for the periods that we look for
+    Bool remove_homopolymers;     // ignore motifs like AA and AAA
+    Bool alt_algo;                // apply the filters before picking the best
+    MatchMaskFunction match_mask; // the fastest one on this machine
+    const char* kernel;           // and its name
+} STRScanner;
+
+// Return a scanner that looks for the periods in the string periods, e.g. 
+// "23" for the 2mers and 3mers, or all of them if it is empty. The kernel that
+// compares the bases is picked for the instructions that this machine 
+// supports. A Bool is not the same size in C and C++, so the scanner is only 
+// allocated and changed here, and C++ code should only hold a pointer to it.
+STRScanner* NewSTRScanner(const uint min_copies,
+                          const uint flank,
+                          const char* const periods,
+                          const Bool remove_homopolymers,
+                          const Bool alt_algo);
+
+// free the scanner
+void FreeSTRScanner(STRScanner** pscanner);
+
+// Convert the bases to upper case. Returns FALSE if any of them is not one of
+// ACGTN or a '.'.
+Bool NormalizeBases(char* const bases, const uint slen);
+
+// Find the best tandem repeat in the bases, which should be in upper case, and
+// the best one in their reverse complement. Every position and period with at
+// least min_copies exact copies of the motif that starts there is a candidate.
+// The best candidate is the longest one; on a tie the one with more copies,
+// i.e. the smaller period; then the one with the larger sequence; and then the
+// one that starts last. Motifs with an N are never reported. With alt_algo,
+// the candidates without enough flank, and homopolymers if they are to be
+// removed, are ignored before picking the best. Otherwise the best candidate
+// is picked first and rejected if it fails those filters. Returns FALSE unless
+// a repeat is reported on both the strands. rc_best is in the coordinates of
+// the reverse complement.
+//
+// The reverse complement is not scanned. The repeats on it are the ones on
+// the bases read the other way, so its best repeat is found by comparing the
+// same candidates with the order of the other strand. Only with alt_algo,
+// where the flank decides which candidates there are, the bases are scanned
+// once more from the start.
+//
+// Before the scan, the bases are compared to the ones a period later for 64
+// positions at a time, and the read is rejected right away if none of the 
+// periods has a stretch of (min_copies - 1) * period positions that match.
+Bool FindBestTandemRepeats(const STRScanner* const scanner,
+                           const char* const bases,
+                           const uint slen,
+                           TandemRepeat* const best,
+                           TandemRepeat* const rc_best);
+
+#endif  // STR_SCANNER_H_
@@ -0,0 +1,164 @@
+#include "thread_pool.h"
+
+#include "trace.h"
+
+// what every thread in the pool needs to know
+typedef struct PoolWorker_st {
+    uint thread;
+    uint num_threads;
+    WorkRange* ranges;
+    WorkFunction func;
+    void* arg;
+} PoolWorker;
+
+// take the next item from the range of this thread
+static Bool TakeItem(WorkRange* const range, uint64_t* const item) {
+    Bool found = FALSE;
+
+    pthread_mutex_lock(&range->lock);
+    if (range->next < range->end) {
+        *item = range->next++;
+        found = TRUE;
+    }
+    pthread_mutex_unlock(&range->lock);
+
+    return found;
+}
+
+// move the second half of the remaining items of a victim to the thief. Returns
+// FALSE if none of the other threads have any items left.
+static Bool StealItems(PoolWorker* const worker) {
+    WorkRange* const mine = worker->ranges + worker->thread;
+    uint indx;
+
+    for (indx = 1; indx < worker->num_threads; indx++) {
+        uint victim = (worker->thread + indx) % worker->num_threads;
+        WorkRange* const theirs = worker->ranges + victim;
+        uint64_t zstart = 0, end = 0;
+
+        pthread_mutex_lock(&theirs->lock);
+        if (theirs->next < theirs->end) {
+            zstart = theirs->next + (theirs->end - theirs->next) / 2;
+            end = theirs->end;
+            theirs->end = zstart;
+        }
+        pthread_mutex_unlock(&theirs->lock);
+
+        if (zstart < end) {
+            pthread_mutex_lock(&mine->lock);
+            mine->next = zstart;
+            mine->end = end;
+            pthread_mutex_unlock(&mine->lock);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static void* RunPoolWorker(void* arg) {
+    PoolWorker* const worker = (PoolWorker*)arg;
+    WorkRange* const mine = worker->ranges + worker->thread;
+    uint64_t item, num_items = 0;
+
+    const uint64_t start = GetTraceTime();
+    SetTraceTrack(POOL_TRACK + worker->thread, "pool");
+
+    do {
+        while (TakeItem(mine, &item) == TRUE) {
+            worker->func(worker->arg, item, worker->thread);
+            num_items++;
+        }
+    } while (StealItems(worker) == TRUE);
+
+    TraceSpan("pool_work", start, NULL, num_items);
+    return NULL;
+}
+
+void RunWorkStealingPool(const uint64_t num_items,
+                         const uint num_threads,
+                         WorkFunction func,
+                         void* const arg) {
+    ForceAssert(num_threads > 0);
+
+    // there is no need to start any threads when we only have one
+    if (num_threads == 1) {
+        uint64_t item;
+        for (item = 0; item < num_items; item++) {
+            func(arg, item, 0);
+        }
+        return;
+    }
+
+    WorkRange* ranges = CkalloczOrDie(num_threads * sizeof(WorkRange));
+    PoolWorker* workers = CkalloczOrDie(num_threads * sizeof(PoolWorker));
+    pthread_t* threads = CkallocOrDie(num_threads * sizeof(pthread_t));
+    uint indx;
+
+    for (indx = 0; indx < num_threads; indx++) {
+        pthread_mutex_init(&ranges[indx].lock, NULL);
+        ranges[indx].next = num_items * indx / num_threads;
+        ranges[indx].end = num_items * (indx + 1) / num_threads;
+
+        workers[indx].thread = indx;
+        workers[indx].num_threads = num_threads;
+        workers[indx].ranges = ranges;
+        workers[indx].func = func;
+        workers[indx].arg = arg;
+    }
+
+    for (indx = 0; indx < num_threads; indx++) {
+        if (pthread_create(&threads[indx], NULL,
+                           RunPoolWorker, &workers[indx]) != 0) {
+            PrintThenDie("Error in creating a thread");
+        }
+    }
+    for (indx = 0; indx < num_threads; indx++) {
+        pthread_join(threads[indx], NULL);
+    }
+
+    for (indx = 0; indx < num_threads; indx++) {
+        pthread_mutex_destroy(&ranges[indx].lock);
+    }
+    Ckfree(threads);
+    Ckfree(workers);
+    Ckfree(ranges);
+}
+
+void InitBlockingQueue(BlockingQueue* const queue, const uint capacity) {
+    memset(queue, 0, sizeof(BlockingQueue));
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    queue->items = CkallocOrDie(capacity * sizeof(void*));
+    queue->capacity = capacity;
+}
+
+void FreeBlockingQueue(BlockingQueue* const queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->cond);
+    Ckfree(queue->items);
+}
+
+void PushToQueue(BlockingQueue* const queue, void* const item) {
+    pthread_mutex_lock(&queue->lock);
+    ForceAssert(queue->count < queue->capacity);
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void* PopFromQueue(BlockingQueue* const queue) {
+    void* item;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        pthread_cond_wait(&queue->cond, &queue->lock);
+    }
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
@@ -0,0 +1,55 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "utilities.h"
+
+// the items that are yet to be processed by a thread are [next, end)
+typedef struct WorkRange_st {
+    pthread_mutex_t lock;
+    uint64_t next;
+    uint64_t end;
+} WorkRange;
+
+// the function that processes an item, on the thread with the given index
+typedef void (*WorkFunction)(void* const arg,
+                             const uint64_t item,
+                             const uint thread);
+
+// Call func for every item in [0, num_items) using num_threads threads. Every
+// thread starts with a contiguous block of the items. A thread that runs out of
+// items steals half of the remaining items from another thread, so threads
+// with expensive items do not hold up the rest. The function returns after
+// all the items have been processed.
+void RunWorkStealingPool(const uint64_t num_items,
+                         const uint num_threads,
+                         WorkFunction func,
+                         void* const arg);
+
+// A blocking queue that hands items from one thread to another, in the order
+// they were pushed. It holds at most capacity items.
+typedef struct BlockingQueue_st {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    void** items;
+    uint capacity;
+    uint head;
+    uint count;
+} BlockingQueue;
+
+// initialize an empty queue with room for capacity items
+void InitBlockingQueue(BlockingQueue* const queue, const uint capacity);
+
+// free the resources used by the queue
+void FreeBlockingQueue(BlockingQueue* const queue);
+
+// Add the item to the queue, which should not be full. A NULL item can be used
+// to mark the end of the items.
+void PushToQueue(BlockingQueue* const queue, void* const item);
+
+// wait for the next item in the queue
+void* PopFromQueue(BlockingQueue* const queue);
+
+#endif  // THREAD_POOL_H_
@@ -0,0 +1,142 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+// the most tracks that are given a name
+#define MAX_NAMED_TRACKS 1024
+
+static FILE* trace_fp = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t trace_start;        // when the trace was opened
+static int trace_pid;
+static uint64_t num_async_spans = 0;
+static Bool named_tracks[MAX_NAMED_TRACKS];
+
+static __thread uint trace_track = MAIN_TRACK;
+
+static uint64_t ReadMonotonicClock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// write the string with the characters that JSON does not allow escaped
+static void WriteJSONString(const char* str) {
+    fputc('"', trace_fp);
+    for (; *str; str++) {
+        if ((*str == '"') || (*str == '\\')) {
+            fputc('\\', trace_fp);
+            fputc(*str, trace_fp);
+        } else if ((uchar)*str < 0x20) {
+            fprintf(trace_fp, "\\u%04x", (uchar)*str);
+        } else {
+            fputc(*str, trace_fp);
+        }
+    }
+    fputc('"', trace_fp);
+}
+
+// name the track, the first time it is seen. The lock should be held.
+static void NameTrack(const uint track, const char* const name) {
+    if ((track < MAX_NAMED_TRACKS) && (named_tracks[track] == TRUE)) return;
+    if (track < MAX_NAMED_TRACKS) named_tracks[track] = TRUE;
+
+    fprintf(trace_fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%u,\"args\":{\"name\":", trace_pid, track);
+    WriteJSONString(name);
+    fprintf(trace_fp, "}}");
+}
+
+void OpenTrace(const char* const fname, const char* const program) {
+    trace_fp = CkopenOrDie(fname, "w");
+    trace_start = ReadMonotonicClock();
+    trace_pid = getpid();
+
+    // The events are in an array, which does not have to be closed in this
+    // format, so the trace of a run that died can still be read.
+    fprintf(trace_fp, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%u,\"args\":{\"name\":", trace_pid, MAIN_TRACK);
+    WriteJSONString(program);
+    fprintf(trace_fp, "}}");
+    NameTrack(MAIN_TRACK, "main");
+}
+
+void CloseTrace(void) {
+    if (trace_fp == NULL) return;
+
+    pthread_mutex_lock(&trace_lock);
+    fprintf(trace_fp, "\n]\n");
+    fclose(trace_fp);
+    trace_fp = NULL;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+Bool IsTracing(void) {
+    return trace_fp != NULL ? TRUE : FALSE;
+}
+
+uint64_t GetTraceTime(void) {
+    if (trace_fp == NULL) return 0;
+    return ReadMonotonicClock() - trace_start;
+}
+
+void SetTraceTrack(const uint track, const char* const name) {
+    trace_track = track;
+    if (trace_fp == NULL) return;
+
+    pthread_mutex_lock(&trace_lock);
+    NameTrack(track, name);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// the arguments of an event, if it has any
+static void WriteArguments(const char* const detail, const uint64_t count) {
+    if ((detail == NULL) && (count == 0)) return;
+
+    fprintf(trace_fp, ",\"args\":{");
+    if (detail != NULL) {
+        fprintf(trace_fp, "\"detail\":");
+        WriteJSONString(detail);
+    }
+    if (count != 0) {
+        fprintf(trace_fp, "%s\"count\":%"PRIu64, detail != NULL ? "," : "",
+                count);
+    }
+    fputc('}', trace_fp);
+}
+
+void TraceSpan(const char* const name,
+               const uint64_t start,
+               const char* const detail,
+               const uint64_t count) {
+    if (trace_fp == NULL) return;
+    const uint64_t end = GetTraceTime();
+
+    pthread_mutex_lock(&trace_lock);
+    fprintf(trace_fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+            "\"ts\":%.3f,\"dur\":%.3f", name, trace_pid, trace_track,
+            start / 1000.0, (end - start) / 1000.0);
+    WriteArguments(detail, count);
+    fputc('}', trace_fp);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void TraceAsyncSpan(const char* const name,
+                    const uint64_t start,
+                    const uint64_t end,
+                    const uint64_t count) {
+    if (trace_fp == NULL) return;
+
+    pthread_mutex_lock(&trace_lock);
+    const uint64_t id = num_async_spans++;
+    fprintf(trace_fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\","
+            "\"id\":%"PRIu64",\"pid\":%d,\"tid\":%u,\"ts\":%.3f", name, name,
+            id, trace_pid, trace_track, start / 1000.0);
+    WriteArguments(NULL, count);
+    fprintf(trace_fp, "},\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"e\","
+            "\"id\":%"PRIu64",\"pid\":%d,\"tid\":%u,\"ts\":%.3f}", name, name,
+            id, trace_pid, trace_track, end / 1000.0);
+    pthread_mutex_unlock(&trace_lock);
+}
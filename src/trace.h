@@ -0,0 +1,53 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
+#include <inttypes.h>
+
+#include "utilities.h"
+
+// A timeline of the run, written in the trace event format of Chrome, which
+// can be opened in Perfetto or chrome://tracing. Every thread writes its
+// events to a track of its own. The events are written to the file as they
+// end, so the trace only has the events that are long enough to matter, e.g.
+// the passes over a file or the batches of work, and not every read.
+
+// the tracks of the threads
+#define MAIN_TRACK    0   // the main thread
+#define COUNTER_TRACK 1   // the thread that counts the kmers in baitstr
+#define POOL_TRACK    2   // the threads of the pool, by their index
+
+// Start writing the events to the file. The events are only recorded when a
+// trace has been opened.
+void OpenTrace(const char* const fname, const char* const program);
+
+// finish the trace, and close the file
+void CloseTrace(void);
+
+// is a trace being written?
+Bool IsTracing(void);
+
+// the time since the trace was opened in nanoseconds, 0 when there is no trace
+uint64_t GetTraceTime(void);
+
+// the events of the calling thread are shown on this track, with this name
+void SetTraceTrack(const uint track, const char* const name);
+
+// An event on the track of the calling thread, that started at start and ends
+// now. The detail, if it is not NULL, and the count, if it is not 0, are shown
+// with the event.
+void TraceSpan(const char* const name,
+               const uint64_t start,
+               const char* const detail,
+               const uint64_t count);
+
+// An event from start to end, that may overlap with the other events on the
+// track of the calling thread, e.g. the walks that are advanced together.
+void TraceAsyncSpan(const char* const name,
+                    const uint64_t start,
+                    const uint64_t end,
+                    const uint64_t count);
+
+#endif  // TRACE_H_
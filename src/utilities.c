@@ -1,5 +1,13 @@
 #include "utilities.h"
 
+#include <unistd.h>
+#include <sys/resource.h>
+
+#ifdef ProfileMemory
+#include <inttypes.h>
+#include <pthread.h>
+#endif
+
 time_t t0;
 
 void _fatalf(const char* const filename,
@@ -55,6 +63,203 @@ void _fatal(const char* const filename,
     _fatalf(filename, lineNumber, "%s", msg);
 }
 
+#ifdef ProfileMemory
+// The allocations are tracked by the line that made them. Every site that
+// allocated memory has the bytes it holds now, the most it held at a time
+// and the number of calls, and every live block remembers its size and the
+// site it is charged to, so the bytes go back to that site when the block is
+// freed, even by another line. The blocks that were not allocated by the
+// wrappers, e.g. by getline, are not tracked and are skipped when freed.
+
+typedef struct AllocationSite_st {
+    const char* filename;
+    uint linenum;
+    size_t live;          // the bytes allocated here that are not freed yet
+    size_t peak;          // the most bytes that were live at a time
+    uint64_t allocs;      // the calls to allocate memory here
+    uint64_t reallocs;    // the calls to reallocate memory here
+    uint64_t frees;       // the blocks allocated here that were freed
+} AllocationSite;
+
+typedef struct LiveBlock_st {
+    void* ptr;            // NULL for an empty slot, or REMOVED_BLOCK
+    size_t size;
+    uint site;
+} LiveBlock;
+
+// marks the slot of a block that was freed, so the lookups go past it
+#define REMOVED_BLOCK ((void*)&live_blocks)
+
+static pthread_mutex_t tracker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static AllocationSite* sites = NULL;    // a hash table of the sites
+static uint num_sites = 0;
+static uint sites_allocated = 0;
+
+static LiveBlock* live_blocks = NULL;   // a hash table of the live blocks
+static size_t num_live_blocks = 0;
+static size_t num_used_slots = 0;       // including the removed blocks
+static size_t blocks_allocated = 0;
+
+static size_t total_live = 0;
+static size_t total_peak = 0;
+
+static void ReportAllocationsAtExit(void) {
+    _reportallocations(NULL, 0);
+}
+
+static size_t HashPointer(const void* const ptr) {
+    uint64_t key = (uint64_t)(uintptr_t)ptr;
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static size_t HashSite(const char* filename, const uint linenum) {
+    size_t hash = 5381 + linenum;
+    while (*filename) hash = hash * 33 + (uchar)*filename++;
+    return hash;
+}
+
+// the index of the site of this line in the table, which is added if needed
+static uint GetAllocationSite(const char* const filename,
+                              const uint linenum) {
+    uint indx;
+
+    if (2 * (num_sites + 1) > sites_allocated) {
+        AllocationSite* const old_sites = sites;
+        const uint old_allocated = sites_allocated;
+        sites_allocated = sites_allocated ? 2 * sites_allocated : 1024;
+        sites = (AllocationSite*)calloc(sites_allocated,
+                                        sizeof(AllocationSite));
+        if (sites == NULL) {
+            fprintf(stderr, "Error in allocating the allocation sites.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (indx = 0; indx < old_allocated; indx++) {
+            const AllocationSite* const site = old_sites + indx;
+            if (site->filename == NULL) continue;
+            uint slot = HashSite(site->filename, site->linenum) &
+                        (sites_allocated - 1);
+            while (sites[slot].filename != NULL) {
+                slot = (slot + 1) & (sites_allocated - 1);
+            }
+            sites[slot] = *site;
+        }
+        if (old_sites == NULL) atexit(ReportAllocationsAtExit);
+        free(old_sites);
+    }
+
+    uint slot = HashSite(filename, linenum) & (sites_allocated - 1);
+    while (sites[slot].filename != NULL) {
+        if (sites[slot].linenum == linenum &&
+            (sites[slot].filename == filename ||
+             strcmp(sites[slot].filename, filename) == 0)) {
+            return slot;
+        }
+        slot = (slot + 1) & (sites_allocated - 1);
+    }
+    sites[slot].filename = filename;
+    sites[slot].linenum = linenum;
+    num_sites++;
+    return slot;
+}
+
+static void GrowLiveBlocks(void) {
+    LiveBlock* const old_blocks = live_blocks;
+    const size_t old_allocated = blocks_allocated;
+    size_t indx;
+
+    // the table is only rehashed at the same size if most of the used slots
+    // are of blocks that were freed
+    if (2 * (num_live_blocks + 1) > blocks_allocated) {
+        blocks_allocated = blocks_allocated ? 2 * blocks_allocated : 65536;
+    }
+    live_blocks = (LiveBlock*)calloc(blocks_allocated, sizeof(LiveBlock));
+    if (live_blocks == NULL) {
+        fprintf(stderr, "Error in allocating the live blocks.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (indx = 0; indx < old_allocated; indx++) {
+        const LiveBlock* const block = old_blocks + indx;
+        if (block->ptr == NULL || block->ptr == REMOVED_BLOCK) continue;
+        size_t slot = HashPointer(block->ptr) & (blocks_allocated - 1);
+        while (live_blocks[slot].ptr != NULL) {
+            slot = (slot + 1) & (blocks_allocated - 1);
+        }
+        live_blocks[slot] = *block;
+    }
+    num_used_slots = num_live_blocks;
+    free(old_blocks);
+}
+
+// charge the block to the site of this line
+static void TrackAllocation(void* const ptr,
+                            const size_t size,
+                            const char* const filename,
+                            const uint linenum,
+                            const Bool is_realloc) {
+    pthread_mutex_lock(&tracker_lock);
+    const uint indx = GetAllocationSite(filename, linenum);
+    AllocationSite* const site = sites + indx;
+    if (is_realloc == TRUE) {
+        site->reallocs++;
+    } else {
+        site->allocs++;
+    }
+    site->live += size;
+    site->peak = MAX(site->peak, site->live);
+    total_live += size;
+    total_peak = MAX(total_peak, total_live);
+
+    if (4 * (num_used_slots + 1) > 3 * blocks_allocated) GrowLiveBlocks();
+    size_t slot = HashPointer(ptr) & (blocks_allocated - 1);
+    while (live_blocks[slot].ptr != NULL &&
+           live_blocks[slot].ptr != REMOVED_BLOCK) {
+        slot = (slot + 1) & (blocks_allocated - 1);
+    }
+    if (live_blocks[slot].ptr == NULL) num_used_slots++;
+    live_blocks[slot].ptr = ptr;
+    live_blocks[slot].size = size;
+    live_blocks[slot].site = indx;
+    num_live_blocks++;
+    pthread_mutex_unlock(&tracker_lock);
+}
+
+// give the bytes of the block back to the site it was charged to
+static void UntrackAllocation(void* const ptr, const Bool is_realloc) {
+    pthread_mutex_lock(&tracker_lock);
+    if (blocks_allocated > 0) {
+        size_t slot = HashPointer(ptr) & (blocks_allocated - 1);
+        while (live_blocks[slot].ptr != NULL) {
+            if (live_blocks[slot].ptr == ptr) {
+                LiveBlock* const block = live_blocks + slot;
+                AllocationSite* const site = sites + block->site;
+                site->live -= block->size;
+                if (is_realloc == FALSE) site->frees++;
+                total_live -= block->size;
+                block->ptr = REMOVED_BLOCK;
+                num_live_blocks--;
+                break;
+            }
+            slot = (slot + 1) & (blocks_allocated - 1);
+        }
+    }
+    pthread_mutex_unlock(&tracker_lock);
+}
+
+static int CompareSitesByPeak(const void* const a, const void* const b) {
+    const AllocationSite* const sa = *(const AllocationSite* const*)a;
+    const AllocationSite* const sb = *(const AllocationSite* const*)b;
+    if (sa->peak != sb->peak) return sa->peak < sb->peak ? 1 : -1;
+    const uint64_t ca = sa->allocs + sa->reallocs;
+    const uint64_t cb = sb->allocs + sb->reallocs;
+    if (ca != cb) return ca < cb ? 1 : -1;
+    return 0;
+}
+#endif
+
 // make a call to malloc, and panic if the allocation request fails.
 void* _ckalloc(const size_t size,
               const char* const filename UNUSED,
@@ -70,6 +275,9 @@ void* _ckalloc(const size_t size,
     fprintf(stderr,
     "%s:%d Allocated %zd bytes at %p.\n", filename, linenum, size, ptr);
 #endif
+#ifdef ProfileMemory
+    TrackAllocation(ptr, size, filename, linenum, FALSE);
+#endif
 
     return ptr;
 }
@@ -94,6 +302,9 @@ void* _ckrealloc(void* p,
                  const char* const filename UNUSED,
                  const uint linenum UNUSED) {
     void* ptr UNUSED = p;
+#ifdef ProfileMemory
+    if (p) UntrackAllocation(p, TRUE);
+#endif
     p = p ? realloc(p, size) : malloc(size);
     if (!p) {
         PrintThenDie("ckrealloc failed");
@@ -104,6 +315,9 @@ void* _ckrealloc(void* p,
     "%s:%d Reallocated %zd bytes from %p to %p\n",
     filename, linenum, size, ptr, p);
 #endif
+#ifdef ProfileMemory
+    TrackAllocation(p, size, filename, linenum, ptr != NULL);
+#endif
 
     return p;
 }
@@ -115,6 +329,9 @@ void _ckfree(void* ptr,
 #ifdef DebugMemory
     fprintf(stderr, "%s:%d Deallocated bytes at %p.\n", filename, linenum, ptr);
 #endif
+#ifdef ProfileMemory
+    if (ptr) UntrackAllocation(ptr, FALSE);
+#endif
 
     if (ptr) free(ptr);
 }
@@ -274,22 +491,72 @@ char* ReverseString(char* sequence, const int length) {
     return sequence;
 }
 
+/* the resident memory of the program in kB, which is read from /proc when it
+   is there, and is the peak resident memory otherwise */
+size_t GetResidentMemory(void) {
+    unsigned long size, resident;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+        int num_read = fscanf(fp, "%lu %lu", &size, &resident);
+        fclose(fp);
+        if (num_read == 2) {
+            return resident * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+    }
+    return GetPeakResidentMemory();
+}
+
+/* the peak resident memory of the program in kB */
+size_t GetPeakResidentMemory(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;
+}
+
 /* report the memory usage of the program at this instant */
 void _report(const char* const filename,
              const int lineNumber) {
-    char cmd[1024];
-    sprintf(cmd, "ps up %d | awk '{print $6}'", getpid());
-    FILE* fp = popen(cmd, "r");
-    if (fp == NULL) { 
-        // popen fails, then I just return
+    fprintf(stderr, "[%s:%d] Memory used (in kB) : %zu\n", 
+    filename, lineNumber, GetResidentMemory());
+}
+
+/* report the memory held by every line that allocated memory, with the lines
+   that held the most at a time first */
+void _reportallocations(const char* const filename,
+                        const int lineNumber) {
+#ifdef ProfileMemory
+    uint indx, num_sorted = 0;
+
+    pthread_mutex_lock(&tracker_lock);
+    AllocationSite** sorted = (AllocationSite**)malloc(
+                              (num_sites + 1) * sizeof(AllocationSite*));
+    if (sorted == NULL) {
+        pthread_mutex_unlock(&tracker_lock);
         return;
     }
-    char path[1024];
-    while (fgets(path, sizeof(path)-1, fp) != NULL) {
+    for (indx = 0; indx < sites_allocated; indx++) {
+        if (sites[indx].filename != NULL) sorted[num_sorted++] = sites + indx;
     }
-    pclose(fp);
-    path[strlen(path)] = 0;
+    qsort(sorted, num_sorted, sizeof(AllocationSite*), CompareSitesByPeak);
 
-    fprintf(stderr, "[%s:%d] Memory used (in kB) : %s", 
-    filename, lineNumber, path);
+    fflush(stdout);
+    if (filename != NULL) {
+        fprintf(stderr, "[%s:%d] ", filename, lineNumber);
+    }
+    fprintf(stderr, "Allocations: %zu bytes in %zu blocks, at most %zu "
+            "bytes\n", total_live, num_live_blocks, total_peak);
+    fprintf(stderr, "%14s %14s %12s %12s %12s  %s\n", "peak bytes",
+            "live bytes", "allocs", "reallocs", "frees", "site");
+    for (indx = 0; indx < num_sorted; indx++) {
+        const AllocationSite* const site = sorted[indx];
+        fprintf(stderr, "%14zu %14zu %12"PRIu64" %12"PRIu64" %12"PRIu64
+                "  %s:%u\n", site->peak, site->live, site->allocs,
+                site->reallocs, site->frees, site->filename, site->linenum);
+    }
+    free(sorted);
+    pthread_mutex_unlock(&tracker_lock);
+#else
+    (void)filename;
+    (void)lineNumber;
+#endif
 }
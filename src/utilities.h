@@ -146,6 +146,15 @@ void _ckfree(void* ptr,
 // Routine to deallocate memory
 #define Ckfree(x) _ckfree(x, __FILE__, __LINE__)
 
+// When compiled with -DProfileMemory (make profile), the wrappers above keep
+// the bytes that every line holds, the most it held at a time and the number
+// of calls. The report is printed on stderr at exit, and can be printed at
+// any other point with ReportAllocations(), which does nothing otherwise.
+void _reportallocations(const char* const filename,
+                        const int lineNumber);
+
+#define ReportAllocations() _reportallocations(__FILE__, __LINE__)
+
 // end of memory allocation routines
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -187,6 +196,12 @@ char* ReverseString(char* sequence, const int length);
 // miscellaneous routines          
 ////////////////////////////////////////////////////////////////////////////////
 
+// the resident memory of the program in kB, without forking another process
+size_t GetResidentMemory(void);
+
+// the peak resident memory of the program in kB
+size_t GetPeakResidentMemory(void);
+
 // this is a routine to report the rough memory usage of the program at the
 // current time point. 
 void _report(const char* const filename,